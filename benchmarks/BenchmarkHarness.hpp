@@ -0,0 +1,300 @@
+/*
+Part of the Fluid Corpus Manipulation Project (http://www.flucoma.org/)
+Copyright 2017-2019 University of Huddersfield.
+Licensed under the BSD-3 License.
+See license.md file in the project root for full license information.
+This project has received funding from the European Research Council (ERC)
+under the European Union’s Horizon 2020 research and innovation programme
+(grant agreement No 725899).
+*/
+#pragma once
+
+#include <data/FluidIndex.hpp>
+#include <data/TensorTypes.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <functional>
+#include <ostream>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#if defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+namespace fluid {
+namespace bench {
+
+// Counts of allocations, kept by the allocation functions that
+// flucoma_bench.cpp replaces
+struct AllocationCounts
+{
+  std::atomic<std::size_t> count{0};
+  std::atomic<std::size_t> bytes{0};
+};
+
+inline AllocationCounts& allocationCounts()
+{
+  static AllocationCounts counts;
+  return counts;
+}
+
+// Peak resident set size of the process so far, in bytes
+inline double peakRSS()
+{
+#if defined(_WIN32)
+  PROCESS_MEMORY_COUNTERS counters;
+  if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+    return 0;
+  return static_cast<double>(counters.PeakWorkingSetSize);
+#else
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage)) return 0;
+#if defined(__APPLE__)
+  return static_cast<double>(usage.ru_maxrss);
+#else
+  return static_cast<double>(usage.ru_maxrss) * 1024.0;
+#endif
+#endif
+}
+
+// Named input signal: one channel per row
+struct Input
+{
+  std::string name;
+  RealMatrix  audio;
+  double      sampleRate;
+
+  index  frames() const { return audio.cols(); }
+  index  channels() const { return audio.rows(); }
+  double seconds() const { return frames() / sampleRate; }
+};
+
+/**
+ Decaying partials over pink-ish noise, with a click every half second, so
+ that pitch, sinusoidal, transient and onset detectors all have something to
+ find. Channels differ in pitch and noise seed.
+ **/
+inline Input syntheticInput(double seconds, index channels, double sampleRate)
+{
+  constexpr double pi = 3.14159265358979323846;
+  index            nFrames = static_cast<index>(seconds * sampleRate);
+  index            period = static_cast<index>(sampleRate / 2);
+  Input input{"synthetic", RealMatrix(channels, nFrames), sampleRate};
+  for (index c = 0; c < channels; c++)
+  {
+    std::mt19937                     rng(static_cast<unsigned>(c + 1));
+    std::uniform_real_distribution<> noise(-1.0, 1.0);
+    double                           f0 = 110.0 * std::pow(2.0, c / 12.0);
+    double                           lowpass = 0;
+    for (index i = 0; i < nFrames; i++)
+    {
+      double t = i / sampleRate;
+      double decay = std::exp(-3.0 * (i % period) / sampleRate);
+      double x = 0;
+      for (index k = 1; k <= 8; k++)
+        x += std::sin(2 * pi * f0 * k * t) / static_cast<double>(k);
+      lowpass = 0.9 * lowpass + 0.1 * noise(rng);
+      x = 0.2 * decay * x + 0.05 * lowpass;
+      if (i % period < 16) x += 0.5 * (1 - (i % period) / 16.0);
+      input.audio(c, i) = x;
+    }
+  }
+  return input;
+}
+
+// One measured case: what was run, and what it cost
+struct Result
+{
+  std::string                                benchmark;
+  std::string                                input;
+  std::vector<std::pair<std::string, index>> params;
+  std::string                                unit;
+  index                                      frames;
+  index                                      iterations;
+  double                                     nsPerFrame;
+  double                                     realTimeFactor;
+  double                                     allocationsPerFrame;
+  double                                     bytesPerFrame;
+  double                                     peakRSS;
+};
+
+struct Options
+{
+  double      minTime{0.25};
+  std::string filter;
+  bool        list{false};
+};
+
+/**
+ Runs benchmark cases and collects their results.
+
+ Each case is a function doing one full iteration of work over framesPerRun
+ frames (analysis windows, host vectors or samples, as named by unit) that
+ cover the given seconds of audio. After one untimed warm-up call, calls are
+ batched so that each of kSamples timings lasts at least minTime / kSamples;
+ the reported time is the median of these. Allocations are counted over all
+ timed calls.
+ **/
+class Harness
+{
+  static constexpr index kSamples = 5;
+
+public:
+  using Params = std::vector<std::pair<std::string, index>>;
+
+  explicit Harness(const Options& options) : mOptions(options) {}
+
+  // false if the filter excludes the benchmark; with --list, prints its name
+  bool wants(const std::string& benchmark)
+  {
+    if (!mOptions.filter.empty() &&
+        benchmark.find(mOptions.filter) == std::string::npos)
+      return false;
+    if (mOptions.list)
+    {
+      if (std::find(mListed.begin(), mListed.end(), benchmark) == mListed.end())
+      {
+        mListed.push_back(benchmark);
+        std::printf("%s\n", benchmark.c_str());
+      }
+      return false;
+    }
+    return true;
+  }
+
+  void run(const std::string& benchmark, const Input& input, Params params,
+           const std::string& unit, index framesPerRun, double seconds,
+           const std::function<void()>& work)
+  {
+    using clock = std::chrono::steady_clock;
+    if (!wants(benchmark) || framesPerRun <= 0) return;
+
+    work();
+
+    double              sampleTime = mOptions.minTime / kSamples;
+    index               batch = 1;
+    std::vector<double> timings;
+    index               iterations = 0;
+    timings.reserve(asUnsigned(kSamples));
+
+    AllocationCounts& allocations = allocationCounts();
+    std::size_t       count = allocations.count;
+    std::size_t       bytes = allocations.bytes;
+    while (asSigned(timings.size()) < kSamples)
+    {
+      auto start = clock::now();
+      for (index i = 0; i < batch; i++) work();
+      double elapsed =
+          std::chrono::duration<double>(clock::now() - start).count();
+      iterations += batch;
+      if (elapsed < sampleTime && timings.empty())
+      {
+        // find a batch size before keeping any timings
+        index scaled = elapsed > 0 ? static_cast<index>(std::ceil(
+                                         batch * sampleTime / elapsed))
+                                   : batch * 2;
+        batch = std::max(batch + 1, scaled);
+        continue;
+      }
+      timings.push_back(elapsed / batch);
+    }
+    double allocated = static_cast<double>(allocations.count - count);
+    double allocatedBytes = static_cast<double>(allocations.bytes - bytes);
+
+    std::nth_element(timings.begin(), timings.begin() + kSamples / 2,
+                     timings.end());
+    double perRun = timings[kSamples / 2];
+    double frames = static_cast<double>(framesPerRun);
+
+    Result result{benchmark,
+                  input.name,
+                  std::move(params),
+                  unit,
+                  framesPerRun,
+                  iterations,
+                  perRun * 1e9 / frames,
+                  perRun / seconds,
+                  allocated / (iterations * frames),
+                  allocatedBytes / (iterations * frames),
+                  peakRSS()};
+    report(result);
+    mResults.push_back(std::move(result));
+  }
+
+  const std::vector<Result>& results() const { return mResults; }
+
+  void writeJSON(std::ostream& out, const std::string& revision) const
+  {
+    out.precision(9);
+    out << "{\n  \"revision\": " << quoted(revision)
+        << ",\n  \"minTime\": " << mOptions.minTime << ",\n  \"results\": [";
+    for (std::size_t i = 0; i < mResults.size(); i++)
+    {
+      const Result& r = mResults[i];
+      out << (i ? ",\n" : "\n") << "    {\"benchmark\": " << quoted(r.benchmark)
+          << ", \"input\": " << quoted(r.input) << ", \"params\": {";
+      for (std::size_t j = 0; j < r.params.size(); j++)
+        out << (j ? ", " : "") << quoted(r.params[j].first) << ": "
+            << r.params[j].second;
+      out << "}, \"unit\": " << quoted(r.unit) << ", \"frames\": " << r.frames
+          << ", \"iterations\": " << r.iterations
+          << ", \"nsPerFrame\": " << r.nsPerFrame
+          << ", \"realTimeFactor\": " << r.realTimeFactor
+          << ", \"allocationsPerFrame\": " << r.allocationsPerFrame
+          << ", \"bytesAllocatedPerFrame\": " << r.bytesPerFrame
+          << ", \"peakRSSBytes\": " << r.peakRSS << "}";
+    }
+    out << "\n  ]\n}\n";
+  }
+
+private:
+  static std::string quoted(const std::string& s)
+  {
+    std::string out = "\"";
+    for (char c : s)
+    {
+      if (c == '"' || c == '\\')
+        out += '\\';
+      else if (static_cast<unsigned char>(c) < 0x20)
+      {
+        char escaped[8];
+        std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+        out += escaped;
+        continue;
+      }
+      out += c;
+    }
+    return out + "\"";
+  }
+
+  // progress goes to stderr, so that stdout can carry the JSON
+  static void report(const Result& r)
+  {
+    std::string params;
+    for (auto& p : r.params)
+      params += " " + p.first + "=" + std::to_string(p.second);
+    std::fprintf(stderr, "%-14s %-38s%-44s %12.1f ns/%s  rtf %.2e  %.3g "
+                 "allocs/%s\n",
+                 r.benchmark.c_str(), r.input.c_str(), params.c_str(),
+                 r.nsPerFrame, r.unit.c_str(), r.realTimeFactor,
+                 r.allocationsPerFrame, r.unit.c_str());
+  }
+
+  Options                  mOptions;
+  std::vector<Result>      mResults;
+  std::vector<std::string> mListed;
+};
+
+} // namespace bench
+} // namespace fluid
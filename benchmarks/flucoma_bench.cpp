@@ -0,0 +1,609 @@
+/*
+Part of the Fluid Corpus Manipulation Project (http://www.flucoma.org/)
+Copyright 2017-2019 University of Huddersfield.
+Licensed under the BSD-3 License.
+See license.md file in the project root for full license information.
+This project has received funding from the European Research Council (ERC)
+under the European Union’s Horizon 2020 research and innovation programme
+(grant agreement No 725899).
+*/
+
+/*
+Benchmarks the algorithms and some of the RT clients over synthetic and
+bundled audio, sweeping their main size parameters. Progress goes to stderr
+and results, as JSON, to stdout or the file given with --out. Run with --help
+for the options.
+*/
+
+#include "BenchmarkHarness.hpp"
+#include <algorithms/public/DCT.hpp>
+#include <algorithms/public/HPSS.hpp>
+#include <algorithms/public/MelBands.hpp>
+#include <algorithms/public/NMF.hpp>
+#include <algorithms/public/NoveltySegmentation.hpp>
+#include <algorithms/public/STFT.hpp>
+#include <algorithms/public/SineExtraction.hpp>
+#include <algorithms/public/Stats.hpp>
+#include <algorithms/public/TransientExtraction.hpp>
+#include <algorithms/public/YINFFT.hpp>
+#include <algorithms/util/MedianFilter.hpp>
+#include <clients/rt/AmpSliceClient.hpp>
+#include <clients/rt/LoudnessClient.hpp>
+#include <clients/rt/MelBandsClient.hpp>
+#include <data/FluidIndex.hpp>
+#include <data/TensorTypes.hpp>
+#include <AudioFile/IAudioFile.h>
+#include <cerrno>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <new>
+
+#ifndef FLUID_BENCH_AUDIO_DIR
+#define FLUID_BENCH_AUDIO_DIR "AudioFiles"
+#endif
+
+#ifndef FLUID_BENCH_REVISION
+#define FLUID_BENCH_REVISION "unknown"
+#endif
+
+// Allocation counting. With glibc, the malloc family itself is replaced, so
+// that Eigen's allocations are seen too; elsewhere only operator new is.
+#if defined(__GLIBC__)
+extern "C" {
+void* __libc_malloc(std::size_t);
+void* __libc_calloc(std::size_t, std::size_t);
+void* __libc_realloc(void*, std::size_t);
+void* __libc_memalign(std::size_t, std::size_t);
+void  __libc_free(void*);
+
+static void* counted(void* p, std::size_t size)
+{
+  auto& counts = fluid::bench::allocationCounts();
+  counts.count++;
+  counts.bytes += size;
+  return p;
+}
+
+void* malloc(std::size_t size) noexcept
+{
+  return counted(__libc_malloc(size), size);
+}
+
+void* calloc(std::size_t n, std::size_t size) noexcept
+{
+  return counted(__libc_calloc(n, size), n * size);
+}
+
+void* realloc(void* p, std::size_t size) noexcept
+{
+  return counted(__libc_realloc(p, size), size);
+}
+
+void* memalign(std::size_t alignment, std::size_t size) noexcept
+{
+  return counted(__libc_memalign(alignment, size), size);
+}
+
+void* aligned_alloc(std::size_t alignment, std::size_t size) noexcept
+{
+  return memalign(alignment, size);
+}
+
+int posix_memalign(void** out, std::size_t alignment,
+                   std::size_t size) noexcept
+{
+  void* p = memalign(alignment, size);
+  if (!p) return ENOMEM;
+  *out = p;
+  return 0;
+}
+
+void free(void* p) noexcept { __libc_free(p); }
+}
+#else
+void* operator new(std::size_t size)
+{
+  auto& counts = fluid::bench::allocationCounts();
+  counts.count++;
+  counts.bytes += size;
+  if (void* p = std::malloc(size ? size : 1)) return p;
+  throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+#endif
+
+namespace fluid {
+namespace bench {
+
+using namespace algorithm;
+
+struct Spectra
+{
+  ComplexMatrix spectrum;
+  RealMatrix    magnitude;
+};
+
+Spectra analyse(const Input& input, index fftSize, index hopSize)
+{
+  STFT       stft(fftSize, fftSize, hopSize);
+  index      nFrames = (input.frames() + hopSize) / hopSize;
+  Spectra    result{ComplexMatrix(nFrames, fftSize / 2 + 1),
+                 RealMatrix(nFrames, fftSize / 2 + 1)};
+  RealVector channel(input.audio.row(0));
+  stft.process(channel, result.spectrum);
+  STFT::magnitude(result.spectrum, result.magnitude);
+  return result;
+}
+
+// the first channels of input, repeating its channels if it has fewer
+RealMatrix channels(const Input& input, index count)
+{
+  RealMatrix result(count, input.frames());
+  for (index c = 0; c < count; c++)
+    result.row(c) = input.audio.row(c % input.channels());
+  return result;
+}
+
+void benchSTFT(Harness& h, const Input& input, bool quick)
+{
+  if (!h.wants("stft")) return;
+  for (index fftSize : {512, 1024, 2048, 4096})
+  {
+    if (quick && fftSize != 1024) continue;
+    for (index overlap : {2, 4})
+    {
+      index         hopSize = fftSize / overlap;
+      STFT          stft(fftSize, fftSize, hopSize);
+      RealVector    channel(input.audio.row(0));
+      index         nFrames = (input.frames() - fftSize) / hopSize + 1;
+      ComplexVector frame(fftSize / 2 + 1);
+      RealVector    magnitude(fftSize / 2 + 1);
+      h.run("stft", input, {{"fftSize", fftSize}, {"hopSize", hopSize}},
+            "window", nFrames, input.seconds(), [&]() {
+              for (index i = 0; i < nFrames; i++)
+              {
+                stft.processFrame(channel(Slice(i * hopSize, fftSize)), frame);
+                STFT::magnitude(frame, magnitude);
+              }
+            });
+    }
+  }
+}
+
+void benchSpectral(Harness& h, const Input& input, bool quick)
+{
+  if (!h.wants("melbands") && !h.wants("dct") && !h.wants("yinfft") &&
+      !h.wants("novelty"))
+    return;
+  for (index fftSize : {512, 1024, 2048, 4096})
+  {
+    if (quick && fftSize != 1024) continue;
+    index   hopSize = fftSize / 2;
+    index   nBins = fftSize / 2 + 1;
+    Spectra spectra = analyse(input, fftSize, hopSize);
+    index   nFrames = spectra.magnitude.rows();
+    Harness::Params params{{"fftSize", fftSize}, {"hopSize", hopSize}};
+
+    for (index nBands : {40, 128})
+    {
+      MelBands   bands(nBands, fftSize, nFrames);
+      RealMatrix mels(nFrames, nBands);
+      bands.init(20, 20000, nBands, nBins, input.sampleRate, fftSize);
+      auto bandParams = params;
+      bandParams.emplace_back("numBands", nBands);
+      h.run("melbands", input, bandParams, "window", nFrames,
+            input.seconds(), [&]() {
+              for (index i = 0; i < nFrames; i++)
+                bands.processFrame(spectra.magnitude.row(i), mels.row(i),
+                                   false, false, true);
+            });
+      if (!h.wants("dct")) continue;
+      bands.processFrames(spectra.magnitude, mels, false, false, true);
+      DCT        dct(nBands, 13);
+      RealVector coefficients(13);
+      dct.init(nBands, 13);
+      h.run("dct", input, bandParams, "window", nFrames, input.seconds(),
+            [&]() {
+              for (index i = 0; i < nFrames; i++)
+                dct.processFrame(mels.row(i), coefficients);
+            });
+    }
+
+    YINFFT     yin;
+    RealVector pitch(2);
+    h.run("yinfft", input, params, "window", nFrames, input.seconds(), [&]() {
+      for (index i = 0; i < nFrames; i++)
+        yin.processFrame(spectra.magnitude.row(i), pitch, 20, 5000,
+                         input.sampleRate);
+    });
+
+    if (fftSize != 1024 || !h.wants("novelty")) continue;
+    MelBands   bands(40, fftSize, nFrames);
+    RealMatrix features(nFrames, 40);
+    bands.init(20, 20000, 40, nBins, input.sampleRate, fftSize);
+    bands.processFrames(spectra.magnitude, features, false, false, true);
+    for (index kernelSize : {3, 17, 51})
+    {
+      for (index filterSize : {1, 5})
+      {
+        if (quick && (kernelSize == 51 || filterSize == 5)) continue;
+        NoveltySegmentation novelty(51, 5);
+        novelty.init(kernelSize, filterSize, 40);
+        auto noveltyParams = params;
+        noveltyParams.emplace_back("kernelSize", kernelSize);
+        noveltyParams.emplace_back("filterSize", filterSize);
+        h.run("novelty", input, noveltyParams, "window", nFrames,
+              input.seconds(), [&]() {
+                for (index i = 0; i < nFrames; i++)
+                  novelty.processFrame(features.row(i), 0.5, 2);
+              });
+      }
+    }
+  }
+}
+
+void benchHPSS(Harness& h, const Input& input, bool quick)
+{
+  if (!h.wants("hpss")) return;
+  index   fftSize = 1024;
+  index   hopSize = 512;
+  index   nBins = fftSize / 2 + 1;
+  Spectra spectra = analyse(input, fftSize, hopSize);
+  index   nFrames = spectra.spectrum.rows();
+  struct Sizes
+  {
+    index harmonic, percussive;
+  };
+  for (Sizes s : {Sizes{17, 31}, Sizes{31, 17}, Sizes{101, 31}, Sizes{17, 101}})
+  {
+    if (quick && s.harmonic != 17) continue;
+    Harness::Params params{{"fftSize", fftSize},
+                           {"hopSize", hopSize},
+                           {"harmFilterSize", s.harmonic},
+                           {"percFilterSize", s.percussive}};
+
+    HPSS          hpss(fftSize, 101, 101);
+    ComplexMatrix out(nBins, 3);
+    hpss.init(nBins, s.harmonic);
+    h.run("hpss", input, params, "window", nFrames, input.seconds(), [&]() {
+      for (index i = 0; i < nFrames; i++)
+        hpss.processFrame(spectra.spectrum.row(i), out, s.percussive,
+                          s.harmonic, HPSS::kClassic, 0, 1, 1, 1, 0, 1, 1, 1);
+    });
+
+    ComplexMatrix harmonic(nFrames, nBins), percussive(nFrames, nBins),
+        residual(nFrames, nBins);
+    h.run("hpss_offline", input, params, "window", nFrames, input.seconds(),
+          [&]() {
+            HPSS::processSpectrogram(spectra.spectrum, harmonic, percussive,
+                                     residual, s.percussive, s.harmonic,
+                                     HPSS::kClassic, 0, 1, 1, 1, 0, 1, 1, 1);
+          });
+  }
+}
+
+void benchNMF(Harness& h, const Input& input, bool quick)
+{
+  if (!h.wants("nmf")) return;
+  index   fftSize = 1024;
+  index   hopSize = 512;
+  index   nBins = fftSize / 2 + 1;
+  Spectra spectra = analyse(input, fftSize, hopSize);
+  index   nFrames = spectra.magnitude.rows();
+  index   iterations = 50;
+  for (index rank : {1, 3, 10})
+  {
+    if (quick && rank != 3) continue;
+    RealMatrix W(rank, nBins), H(nFrames, rank), V(nFrames, nBins);
+    h.run("nmf", input,
+          {{"fftSize", fftSize},
+           {"hopSize", hopSize},
+           {"rank", rank},
+           {"iterations", iterations}},
+          "window", nFrames, input.seconds(), [&]() {
+            NMF nmf;
+            nmf.process(spectra.magnitude, W, H, V, rank, iterations, true,
+                        true);
+          });
+  }
+}
+
+void benchTimeDomain(Harness& h, const Input& input, bool quick)
+{
+  RealVector channel(input.audio.row(0));
+  index      nSamples = channel.size();
+
+  if (h.wants("transients"))
+  {
+    for (index order : {20, 40})
+    {
+      for (index blockSize : {256, 1024})
+      {
+        if (quick && (order != 20 || blockSize != 256)) continue;
+        TransientExtraction extractor;
+        extractor.init(order, blockSize, 128);
+        extractor.setDetectionParameters(1, 2, 1.1, 7, 25);
+        index      hopSize = extractor.hopSize();
+        index      inputSize = extractor.inputSize();
+        index      nHops = (nSamples - inputSize) / hopSize + 1;
+        RealVector transients(hopSize), residual(hopSize);
+        h.run("transients", input,
+              {{"order", order}, {"blockSize", blockSize}, {"padSize", 128}},
+              "hop", nHops, input.seconds(), [&]() {
+                for (index i = 0; i < nHops; i++)
+                  extractor.process(channel(Slice(i * hopSize, inputSize)),
+                                    transients, residual);
+              });
+      }
+    }
+  }
+
+  if (h.wants("sines"))
+  {
+    for (index fftSize : {1024, 2048, 4096})
+    {
+      if (quick && fftSize != 1024) continue;
+      index          hopSize = fftSize / 4;
+      Spectra        spectra = analyse(input, fftSize, hopSize);
+      index          nFrames = spectra.spectrum.rows();
+      SineExtraction sines;
+      ComplexMatrix  out(fftSize / 2 + 1, 2);
+      sines.init(fftSize, fftSize, 16384);
+      h.run("sines", input, {{"fftSize", fftSize}, {"hopSize", hopSize}},
+            "window", nFrames, input.seconds(), [&]() {
+              for (index i = 0; i < nFrames; i++)
+                sines.processFrame(spectra.spectrum.row(i), out,
+                                   input.sampleRate, -96, 15, -24, -60, 0, 15,
+                                   50, 0.5, 76);
+            });
+    }
+  }
+
+  if (h.wants("median"))
+  {
+    for (index size : {3, 5, 7, 9, 15, 31, 51, 101})
+    {
+      if (quick && size != 5 && size != 31) continue;
+      MedianFilter filter;
+      RealVector   out(nSamples);
+      filter.init(size);
+      h.run("median", input, {{"filterSize", size}}, "sample", nSamples,
+            input.seconds(), [&]() { filter.process(channel, out); });
+    }
+  }
+
+  if (h.wants("stats"))
+  {
+    for (index approximate : {0, 1})
+    {
+      Stats      stats;
+      RealVector out(21);
+      stats.init(2, 10, 50, 90, approximate == 1);
+      h.run("stats", input, {{"numDerivs", 2}, {"approximate", approximate}},
+            "sample", nSamples, input.seconds(),
+            [&]() { stats.process(channel, out); });
+    }
+  }
+}
+
+template <typename Params>
+using ClientParams =
+    client::ParameterSet<const typename std::remove_const<Params>::type>;
+
+// Feeds rows [first, first + count) of audio to client hostSize samples at a
+// time, giving it the rows of out as outputs
+template <typename Client>
+void stream(Client& client, RealMatrix& audio, index first, index count,
+            RealMatrix& out, index hostSize)
+{
+  using HostVector = FluidTensorView<double, 1>;
+  client::FluidContext    context;
+  std::vector<HostVector> in, outs;
+  in.reserve(asUnsigned(count));
+  outs.reserve(asUnsigned(out.rows()));
+  for (index start = 0; start + hostSize <= audio.cols(); start += hostSize)
+  {
+    in.clear();
+    outs.clear();
+    for (index c = first; c < first + count; c++)
+      in.push_back(audio.row(c)(Slice(start, hostSize)));
+    for (index c = 0; c < out.rows(); c++) outs.push_back(out.row(c));
+    client.process(in, outs, context);
+  }
+}
+
+// a client has either audio or control outputs
+template <typename Client>
+index outputs(const Client& client)
+{
+  return client.audioChannelsOut() + client.controlChannelsOut();
+}
+
+// One instance per channel, or one multichannel instance for all of them
+template <typename Single, typename Multi, typename SingleParams,
+          typename MultiParams, index ChannelsParam>
+void benchChannels(Harness& h, const std::string& name, const Input& input,
+                   const SingleParams& singleDefaults,
+                   const MultiParams& multiDefaults, bool quick)
+{
+  if (!h.wants(name)) return;
+  index hostSize = 64;
+  for (index nChannels : {1, 2, 4, 8})
+  {
+    if (quick && nChannels != 4) continue;
+    RealMatrix audio = channels(input, nChannels);
+    index      nBlocks = audio.cols() / hostSize;
+
+    ClientParams<SingleParams>           single(singleDefaults);
+    std::vector<std::unique_ptr<Single>> instances;
+    for (index c = 0; c < nChannels; c++)
+    {
+      instances.emplace_back(new Single(single));
+      instances.back()->sampleRate(input.sampleRate);
+    }
+    RealMatrix singleOut(outputs(*instances[0]), hostSize);
+    h.run(name, input, {{"channels", nChannels}, {"multichannel", 0}},
+          "hostVector", nBlocks, input.seconds(), [&]() {
+            for (index c = 0; c < nChannels; c++)
+              stream(*instances[asUnsigned(c)], audio, c, 1, singleOut,
+                     hostSize);
+          });
+
+    ClientParams<MultiParams> multi(multiDefaults);
+    multi.template set<ChannelsParam>(index(nChannels), nullptr);
+    Multi multiInstance(multi);
+    multiInstance.sampleRate(input.sampleRate);
+    RealMatrix multiOut(outputs(multiInstance), hostSize);
+    h.run(name, input, {{"channels", nChannels}, {"multichannel", 1}},
+          "hostVector", nBlocks, input.seconds(), [&]() {
+            stream(multiInstance, audio, 0, nChannels, multiOut, hostSize);
+          });
+  }
+}
+
+void benchClients(Harness& h, const Input& input, bool quick)
+{
+  using namespace client;
+  benchChannels<LoudnessClient<double>, MultiChannelLoudnessClient<double>,
+                decltype(LoudnessParams), decltype(MultiChannelLoudnessParams),
+                kLoudnessChannels>(h, "rt_loudness", input, LoudnessParams,
+                                   MultiChannelLoudnessParams, quick);
+  benchChannels<MelBandsClient<double>, MultiChannelMelBandsClient<double>,
+                decltype(MelBandsParams), decltype(MultiChannelMelBandsParams),
+                kMelBandsChannels>(h, "rt_melbands", input, MelBandsParams,
+                                   MultiChannelMelBandsParams, quick);
+  benchChannels<AmpSliceClient<double>, MultiChannelAmpSliceClient<double>,
+                decltype(AmpSliceParams), decltype(MultiChannelAmpSliceParams),
+                kAmpSliceChannels>(h, "rt_ampslice", input, AmpSliceParams,
+                                   MultiChannelAmpSliceParams, quick);
+}
+
+// The first seconds of a file in AudioFiles/, empty if it can't be read
+Input audioFileInput(const std::string& directory, const std::string& name,
+                     double seconds)
+{
+  HISSTools::IAudioFile file(directory + "/" + name);
+  if (!file.isOpen()) return {name, RealMatrix(0, 0), 0};
+  double sampleRate = file.getSamplingRate();
+  index  nFrames = std::min(static_cast<index>(file.getFrames()),
+                           static_cast<index>(seconds * sampleRate));
+  index  nChannels = static_cast<index>(file.getChannels());
+  Input  input{name, RealMatrix(nChannels, nFrames), sampleRate};
+  for (index c = 0; c < nChannels; c++)
+  {
+    file.seek(0);
+    file.readChannel(input.audio.row(c).data(), static_cast<uintptr_t>(nFrames),
+                     static_cast<uint16_t>(c));
+  }
+  return input;
+}
+
+void usage()
+{
+  std::cerr
+      << "usage: flucoma_bench [options]\n"
+         "  --out FILE        write the JSON results to FILE (default stdout)\n"
+         "  --filter NAME     only run benchmarks whose name contains NAME\n"
+         "  --list            list the benchmark names and exit\n"
+         "  --min-time SECS   time spent measuring each case (default 0.25)\n"
+         "  --seconds SECS    length of each input (default 5)\n"
+         "  --audio DIR       folder of the bundled audio files\n"
+         "  --no-audio        synthetic input only\n"
+         "  --quick           fewer sizes per sweep\n"
+         "  --revision LABEL  label stored with the results\n";
+}
+
+} // namespace bench
+} // namespace fluid
+
+int main(int argc, char* argv[])
+{
+  using namespace fluid::bench;
+  Options     options;
+  std::string outFile;
+  std::string audioDir = FLUID_BENCH_AUDIO_DIR;
+  std::string revision = FLUID_BENCH_REVISION;
+  double      seconds = 5;
+  bool        useAudio = true;
+  bool        quick = false;
+
+  for (int i = 1; i < argc; i++)
+  {
+    std::string arg = argv[i];
+    bool        hasValue = i + 1 < argc;
+    if (arg == "--out" && hasValue)
+      outFile = argv[++i];
+    else if (arg == "--filter" && hasValue)
+      options.filter = argv[++i];
+    else if (arg == "--list")
+      options.list = true;
+    else if (arg == "--min-time" && hasValue)
+      options.minTime = std::atof(argv[++i]);
+    else if (arg == "--seconds" && hasValue)
+      seconds = std::atof(argv[++i]);
+    else if (arg == "--audio" && hasValue)
+      audioDir = argv[++i];
+    else if (arg == "--no-audio")
+      useAudio = false;
+    else if (arg == "--quick")
+      quick = true;
+    else if (arg == "--revision" && hasValue)
+      revision = argv[++i];
+    else
+    {
+      usage();
+      return arg == "--help" ? 0 : 1;
+    }
+  }
+  if (options.minTime <= 0 || seconds <= 0)
+  {
+    usage();
+    return 1;
+  }
+
+  std::vector<Input> inputs;
+  inputs.push_back(syntheticInput(seconds, 8, 44100));
+  if (useAudio && !options.list)
+  {
+    for (const char* name : {"Nicol-LoopE-M.wav",
+                             "Tremblay-AaS-SynthTwoVoices-M.wav",
+                             "Tremblay-SA-UprightPianoPedalWide.wav"})
+    {
+      Input input = audioFileInput(audioDir, name, seconds);
+      if (input.frames() > 0)
+        inputs.push_back(std::move(input));
+      else
+        std::cerr << "skipping " << audioDir << "/" << name << "\n";
+    }
+  }
+
+  Harness harness(options);
+  for (const Input& input : inputs)
+  {
+    benchSTFT(harness, input, quick);
+    benchSpectral(harness, input, quick);
+    benchHPSS(harness, input, quick);
+    benchNMF(harness, input, quick);
+    benchTimeDomain(harness, input, quick);
+    benchClients(harness, input, quick);
+    if (options.list) break;
+  }
+  if (options.list) return 0;
+
+  if (outFile.empty())
+    harness.writeJSON(std::cout, revision);
+  else
+  {
+    std::ofstream out(outFile);
+    if (!out)
+    {
+      std::cerr << "Couldn't open " << outFile << "\n";
+      return 1;
+    }
+    harness.writeJSON(out, revision);
+  }
+  return 0;
+}
@@ -28,11 +28,11 @@ class CepstrumF0
 public:
   using ArrayXd = Eigen::ArrayXd;
 
-  CepstrumF0(index maxSize) : mCepstrumStorage(maxSize) {}
+  CepstrumF0(index maxSize) : mDCT(maxSize, maxSize), mCepstrumStorage(maxSize)
+  {}
 
-  void init(index size) {
-    //avoid allocation of maxSize^2 at constructor
-    mDCT = DCT(size, size);
+  void init(index size)
+  {
     mDCT.init(size, size);
 
     mCepstrum = mCepstrumStorage.segment(0, size);
@@ -69,7 +69,7 @@ public:
   }
 
 private:
-  DCT     mDCT{0,0};
+  DCT     mDCT;
   ArrayXd mCepstrumStorage;
   ArrayXd mCepstrum;
 };
@@ -11,59 +11,215 @@ under the European Union’s Horizon 2020 research and innovation programme
 #pragma once
 
 #include "../util/AlgorithmUtils.hpp"
+#include "../util/ConvolutionTools.hpp"
 #include "../util/FluidEigenMappings.hpp"
 #include "../../data/FluidIndex.hpp"
 #include "../../data/TensorTypes.hpp"
 #include <Eigen/Core>
 #include <cassert>
+#include <algorithm>
 #include <cmath>
+#include <memory>
 
 namespace fluid {
 namespace algorithm {
 
+/**
+ Orthonormal DCT-II, keeping the first outputSize coefficients.
+
+ Small transforms multiply by a table of cosines. Larger ones avoid the
+ outputSize x inputSize table, and compute the whole transform with a
+ complex FFT instead. Any input size is handled as a chirp convolution
+ (Bluestein), which, since the chirp is symmetric, needs an FFT of only
+ 2 * (inputSize - 1) points.
+ **/
 class DCT
 {
 public:
   using ArrayXd = Eigen::ArrayXd;
   using MatrixXd = Eigen::MatrixXd;
 
-  DCT(index maxInputSize, index maxOutputSize){
-    mTableStorage = MatrixXd::Zero(maxOutputSize, maxInputSize);
-  }
+  DCT(index maxInputSize, index maxOutputSize)
+      : mMaxFFTSizeLog2(fftSizeLog2(maxInputSize)),
+        mTableStorage(maxTableSize(maxInputSize, maxOutputSize)),
+        mPreReal(maxInputSize), mPreImag(maxInputSize),
+        mPostReal(maxOutputSize), mPostImag(maxOutputSize),
+        mChirpReal(index(1) << mMaxFFTSizeLog2),
+        mChirpImag(index(1) << mMaxFFTSizeLog2),
+        mProduct(index(1) << mMaxFFTSizeLog2), mResult(maxOutputSize),
+        mFFTSetup(new impl::FFTComplexSetup(asUnsigned(mMaxFFTSizeLog2))),
+        mSpectrum(new impl::TempSpectra(asUnsigned(1) << mMaxFFTSizeLog2))
+  {}
 
   void init(index inputSize, index outputSize)
   {
     using namespace std;
     assert(inputSize >= outputSize);
+    assert(fftSizeLog2(inputSize) <= mMaxFFTSizeLog2);
     mInputSize = inputSize;
     mOutputSize = outputSize;
-    mTable = mTableStorage.block(0, 0, mOutputSize, mInputSize);
-    mTable.setZero();
-    for (index i = 0; i < mOutputSize; i++)
+    mUseTable = outputSize * inputSize <= tableLimit(inputSize);
+    if (mUseTable)
     {
-      double  scale = i == 0 ? 1.0 / sqrt(inputSize) : sqrt(2.0 / inputSize);
-      ArrayXd freqs = ((pi / inputSize) * i) *
-                      ArrayXd::LinSpaced(inputSize, 0.5, inputSize - 0.5);
-      mTable.row(i) = freqs.cos() * scale;
+      assert(outputSize * inputSize <= mTableStorage.size());
+      auto table = tableMap();
+      for (index i = 0; i < mOutputSize; i++)
+      {
+        double  scale = i == 0 ? 1.0 / sqrt(inputSize) : sqrt(2.0 / inputSize);
+        ArrayXd freqs = ((pi / inputSize) * i) *
+                        ArrayXd::LinSpaced(inputSize, 0.5, inputSize - 0.5);
+        table.row(i) = freqs.cos() * scale;
+      }
     }
+    else
+      initChirps();
   }
 
-  void processFrame(const RealVector in, RealVectorView out)
+  void processFrame(const RealVectorView in, RealVectorView out)
   {
-    assert(in.size() == mInputSize);
-    ArrayXd frame = _impl::asEigen<Eigen::Array>(in);
-    ArrayXd result = (mTable * frame.matrix()).array();
-    out = _impl::asFluid(result);
+    assert(in.size() == mInputSize && out.size() == mOutputSize);
+    ArrayXd& result = mResult;
+    processFrame(_impl::asEigen<Eigen::Array>(in), result.head(mOutputSize));
+    _impl::asFluid<Eigen::Array>(out) = result.head(mOutputSize);
   }
 
   void processFrame(Eigen::Ref<const ArrayXd> input, Eigen::Ref<ArrayXd> output)
   {
-    output = (mTable * input.matrix()).array();
+    assert(input.size() == mInputSize && output.size() == mOutputSize);
+    if (mUseTable)
+      output = (tableMap() * input.matrix()).array();
+    else
+      processFFT(input, output);
+  }
+
+  index mInputSize{40};
+  index mOutputSize{13};
+
+private:
+  // the table is used while it costs no more than a few passes of the FFT,
+  // and stays small enough to be cached
+  static index tableLimit(index inputSize)
+  {
+    index log2 = fftSizeLog2(inputSize);
+    return std::min(8 * (log2 + 1) * (index(1) << log2), index(1) << 16);
+  }
+
+  // largest table init() can choose within the maximum sizes
+  static index maxTableSize(index maxInputSize, index maxOutputSize)
+  {
+    index size = 0;
+    for (index in = 1; in <= maxInputSize; in++)
+    {
+      index out = std::min({maxOutputSize, in, tableLimit(in) / in});
+      size = std::max(size, out * in);
+    }
+    return size;
+  }
+
+  Eigen::Map<MatrixXd> tableMap()
+  {
+    return {mTableStorage.data(), mOutputSize, mInputSize};
+  }
+
+  static index fftSizeLog2(index inputSize)
+  {
+    return static_cast<index>(
+        impl::ilog2(asUnsigned(std::max(2 * inputSize - 2, index(1)))));
+  }
+
+  // phase of exp(-i * pi * n / (2 * N)), reducing n mod 4N first so that
+  // large arguments keep their accuracy
+  double chirpPhase(index n)
+  {
+    return -pi * (n % (4 * mInputSize)) / (2.0 * mInputSize);
   }
-  index    mInputSize{40};
-  index    mOutputSize{13};
-  MatrixXd mTable;
-  MatrixXd mTableStorage;
+
+  // With c(m) = exp(-i pi m^2 / 2N), the transform is
+  //   X(k) = scale(k) Re[exp(-i pi (k^2 + k) / 2N) sum_n x(n) c(n) c*(k - n)],
+  // a circular convolution of x(n) c(n) with the conjugate chirp, which is
+  // the same at m and -m.
+  void initChirps()
+  {
+    index N = mInputSize;
+    mFFTSizeLog2 = fftSizeLog2(N);
+    mFFTSize = index(1) << mFFTSizeLog2;
+    for (index n = 0; n < N; n++)
+    {
+      mPreReal(n) = std::cos(chirpPhase(n * n));
+      mPreImag(n) = std::sin(chirpPhase(n * n));
+    }
+    for (index k = 0; k < mOutputSize; k++)
+    {
+      double scale = (k == 0 ? std::sqrt(1.0 / N) : std::sqrt(2.0 / N)) /
+                     static_cast<double>(mFFTSize);
+      mPostReal(k) = std::cos(chirpPhase(k * k + k)) * scale;
+      mPostImag(k) = std::sin(chirpPhase(k * k + k)) * scale;
+    }
+    auto re = realPart();
+    auto im = imagPart();
+    re.setZero();
+    im.setZero();
+    for (index m = 0; m < N; m++)
+    {
+      index j = m ? mFFTSize - m : 0;
+      re(m) = re(j) = mPreReal(m);
+      im(m) = im(j) = -mPreImag(m);
+    }
+    impl::transformForward(*mFFTSetup, mSpectrum->mSpectra,
+                           asUnsigned(mFFTSizeLog2));
+    mChirpReal.head(mFFTSize) = re;
+    mChirpImag.head(mFFTSize) = im;
+  }
+
+  void processFFT(Eigen::Ref<const ArrayXd> input, Eigen::Ref<ArrayXd> output)
+  {
+    index N = mInputSize;
+    auto  re = realPart();
+    auto  im = imagPart();
+    auto  chirpReal = mChirpReal.head(mFFTSize);
+    auto  chirpImag = mChirpImag.head(mFFTSize);
+    auto  product = mProduct.head(mFFTSize);
+    re.head(N) = input * mPreReal.head(N);
+    im.head(N) = input * mPreImag.head(N);
+    re.tail(mFFTSize - N).setZero();
+    im.tail(mFFTSize - N).setZero();
+    impl::transformForward(*mFFTSetup, mSpectrum->mSpectra,
+                           asUnsigned(mFFTSizeLog2));
+    product = re * chirpReal - im * chirpImag;
+    im = re * chirpImag + im * chirpReal;
+    re = product;
+    impl::transformInverse(*mFFTSetup, mSpectrum->mSpectra,
+                           asUnsigned(mFFTSizeLog2));
+    output = re.head(mOutputSize) * mPostReal.head(mOutputSize) -
+             im.head(mOutputSize) * mPostImag.head(mOutputSize);
+  }
+
+  Eigen::Map<ArrayXd> realPart()
+  {
+    return {mSpectrum->mSpectra.realp, mFFTSize};
+  }
+
+  Eigen::Map<ArrayXd> imagPart()
+  {
+    return {mSpectrum->mSpectra.imagp, mFFTSize};
+  }
+
+  bool    mUseTable{true};
+  index   mFFTSize{1};
+  index   mFFTSizeLog2{0};
+  index   mMaxFFTSizeLog2;
+  ArrayXd mTableStorage;
+  ArrayXd mPreReal; // c(n)
+  ArrayXd mPreImag;
+  ArrayXd mPostReal; // exp(-i pi (k^2 + k) / 2N), with scaling
+  ArrayXd mPostImag;
+  ArrayXd mChirpReal; // spectrum of c*(m)
+  ArrayXd mChirpImag;
+  ArrayXd mProduct;
+  ArrayXd mResult;
+
+  std::unique_ptr<impl::FFTComplexSetup> mFFTSetup;
+  std::unique_ptr<impl::TempSpectra>     mSpectrum;
 };
 } // namespace algorithm
 } // namespace fluid
@@ -10,13 +10,18 @@ under the European Union’s Horizon 2020 research and innovation programme
 
 #pragma once
 
+#include "../util/BiquadCascade.hpp"
 #include "../util/ButterworthHPFilter.hpp"
+#include "../util/DecibelBlocks.hpp"
 #include "../util/FluidEigenMappings.hpp"
 #include "../util/SlideUDFilter.hpp"
 #include "../../data/FluidIndex.hpp"
 #include "../../data/TensorTypes.hpp"
 #include <Eigen/Core>
+#include <algorithm>
+#include <cassert>
 #include <cmath>
+#include <vector>
 
 namespace fluid {
 namespace algorithm {
@@ -28,10 +33,8 @@ class EnvelopeGate
 
 public:
   EnvelopeGate(index maxSize)
-  {
-    mInputStorage = ArrayXd(maxSize);
-    mOutputStorage = ArrayXd(maxSize);
-  }
+      : mInputBuffer(maxSize), mOutputBuffer(maxSize), mMaxSize(maxSize)
+  {}
 
   void init(double onThreshold, double offThreshold,
             double hiPassFreq,
@@ -48,6 +51,7 @@ public:
     mLatency = max<index>(mMinTimeAboveThreshold + mUpwardLookupTime,
                           mDownwardLatency);
     if (mLatency < 0) mLatency = 1;
+    assert(mLatency <= mMaxSize);
     mHiPassFreq = hiPassFreq;
     initFilters(mHiPassFreq);
     double initVal = min(onThreshold, offThreshold) - 1;
@@ -68,22 +72,56 @@ public:
   {
     using namespace std;
     assert(mInitialized);
-
-    mSlide.updateCoeffs(rampUpTime, rampDownTime);
+    updateParams(rampUpTime, rampDownTime, hiPassFreq);
 
     double filtered = in;
-    if (hiPassFreq != mHiPassFreq)
-    {
-      initFilters(hiPassFreq);
-      mHiPassFreq = hiPassFreq;
-    }
     if (mHiPassFreq > 0)
-      filtered = mHiPass2.processSample(mHiPass1.processSample(in));
+      filtered = mHiPass.processSample(in);
 
     double rectified = abs(filtered);
     double dB = 20 * log10(rectified);
     double floor = min(offThreshold, onThreshold) - 1;
     double clipped = max(dB, floor);
+    return gate(clipped, onThreshold, offThreshold, minEventDuration,
+                minSilenceDuration);
+  }
+
+  // gates a block of samples with the same parameters throughout, optionally
+  // with an approximate log10 (see fastLog10); in and out may be the same
+  void process(const RealVectorView in, RealVectorView out,
+               double onThreshold, double offThreshold, index rampUpTime,
+               index rampDownTime, double hiPassFreq, index minEventDuration,
+               index minSilenceDuration, bool approximateLog = false)
+  {
+    assert(mInitialized);
+    assert(in.size() == out.size());
+    updateParams(rampUpTime, rampDownTime, hiPassFreq);
+    double floor = std::min(offThreshold, onThreshold) - 1;
+    DecibelBlocks::process(in, out, mHiPassFreq > 0 ? &mHiPass : nullptr,
+                           floor, approximateLog, [&](double dB) {
+                             return gate(dB, onThreshold, offThreshold,
+                                         minEventDuration, minSilenceDuration);
+                           });
+  }
+
+  index getLatency() { return mLatency; }
+  bool  initialized() { return mInitialized; }
+
+
+private:
+  void updateParams(index rampUpTime, index rampDownTime, double hiPassFreq)
+  {
+    mSlide.updateCoeffs(rampUpTime, rampDownTime);
+    if (hiPassFreq != mHiPassFreq)
+    {
+      initFilters(hiPassFreq);
+      mHiPassFreq = hiPassFreq;
+    }
+  }
+
+  double gate(double clipped, double onThreshold, double offThreshold,
+              index minEventDuration, index minSilenceDuration)
+  {
     double smoothed = mSlide.processSample(clipped);
     bool   forcedState = false;
 
@@ -94,7 +132,7 @@ public:
       else
       {
         forcedState = true;
-        mOutputBuffer(mLatency - 1) = 1;
+        output(mLatency - 1) = 1;
         mEventCount++;
       }
       // case 2: we are waiting for silence to finish
@@ -105,7 +143,7 @@ public:
       else
       {
         forcedState = true;
-        mOutputBuffer(mLatency - 1) = 0;
+        output(mLatency - 1) = 0;
         mSilenceCount++;
       }
     }
@@ -123,7 +161,7 @@ public:
         index onsetIndex =
             refineStart(mLatency - mMinTimeAboveThreshold - mUpwardLookupTime,
                         mUpwardLookupTime);
-        mOutputBuffer.segment(onsetIndex, mLatency - onsetIndex) = 1;
+        fillOutput(onsetIndex, 1);
         mEventCount = mOnStateCount;
         mOutputState = true; // we are officially on
       }
@@ -133,57 +171,74 @@ public:
 
         index offsetIndex =
             refineStart(mLatency - mDownwardLatency, mDownwardLookupTime);
-        mOutputBuffer.segment(offsetIndex, mLatency - offsetIndex) = 0;
+        fillOutput(offsetIndex, 0);
         mSilenceCount = mOffStateCount;
         mOutputState = false; // we are officially off
       }
 
-      mOutputBuffer(mLatency - 1) = mOutputState ? 1 : 0;
+      output(mLatency - 1) = mOutputState ? 1 : 0;
       mInputState = nextState;
     }
-    if (mLatency > 1)
-    {
-      mOutputBuffer.segment(0, mLatency - 1) =
-          mOutputBuffer.segment(1, mLatency - 1);
-
-      mInputBuffer.segment(0, mLatency - 1) =
-          mInputBuffer.segment(1, mLatency - 1);
-    }
-    mInputBuffer(mLatency - 1) = smoothed;
+    // advancing the head moves every position one step towards the start;
+    // the newest input goes in the slot that falls off the start, and the
+    // newest output is always written before it is read
+    if (++mHead == mLatency) mHead = 0;
+    input(mLatency - 1) = smoothed;
     if (mFillCount < mLatency) mFillCount++;
-    return mOutputBuffer(0);
+    return output(0);
   }
 
-  index getLatency() { return mLatency; }
-  bool  initialized() { return mInitialized; }
+  // the look-ahead buffers are rings of mLatency samples, with position 0
+  // (the oldest) at mHead
+  index slot(index i)
+  {
+    i += mHead;
+    return i < mLatency ? i : i - mLatency;
+  }
 
+  double& input(index i) { return mInputBuffer(slot(i)); }
+  double& output(index i) { return mOutputBuffer(slot(i)); }
+
+  // sets output positions start to mLatency - 1
+  void fillOutput(index start, double value)
+  {
+    index first = slot(start);
+    index count = mLatency - start;
+    index beforeWrap = std::min(count, mLatency - first);
+    mOutputBuffer.segment(first, beforeWrap).setConstant(value);
+    mOutputBuffer.head(count - beforeWrap).setConstant(value);
+  }
 
-private:
   void initBuffers(double initialValue)
   {
     using namespace std;
-    mInputBuffer = mInputStorage.segment(0, max<index>(mLatency, 1))
-                       .setConstant(initialValue);
-    mOutputBuffer =
-        mOutputStorage.segment(0, max<index>(mLatency, 1)).setZero();
+    index size = max<index>(mLatency, 1);
+    mInputBuffer.head(size).setConstant(initialValue);
+    mOutputBuffer.head(size).setZero();
+    mHead = 0;
     mInputState = false;
     mOutputState = false;
-    mFillCount = max<index>(mLatency, 1);
+    mFillCount = size;
   }
 
   void initFilters(double cutoff)
   {
-    mHiPass1.init(cutoff);
-    mHiPass2.init(cutoff);
+    BiquadCoefficients c = ButterworthHPFilter::coefficients(cutoff);
+    mHiPass.init({{c, c}});
   }
 
+  // position of the (first) minimum input in start to start + nSamples - 1
   index refineStart(index start, index nSamples)
   {
     if (nSamples < 2) return start + nSamples;
-    ArrayXd        seg = mInputBuffer.segment(start, nSamples);
-    ArrayXd::Index index;
-    seg.minCoeff(&index);
-    return start + index;
+    index first = slot(start);
+    index beforeWrap = std::min(nSamples, mLatency - first);
+    ArrayXd::Index pos, wrappedPos;
+    double         min = mInputBuffer.segment(first, beforeWrap).minCoeff(&pos);
+    if (beforeWrap < nSamples &&
+        mInputBuffer.head(nSamples - beforeWrap).minCoeff(&wrappedPos) < min)
+      pos = beforeWrap + wrappedPos;
+    return start + pos;
   }
 
   void updateCounters(bool nextState)
@@ -210,6 +265,7 @@ private:
 
   index  mLatency;
   index  mFillCount;
+  index  mHead{0};
   double mHiPassFreq{0};
 
   index mMinTimeAboveThreshold{440};
@@ -220,8 +276,7 @@ private:
 
   ArrayXd mInputBuffer;
   ArrayXd mOutputBuffer;
-  ArrayXd mInputStorage;
-  ArrayXd mOutputStorage;
+  index   mMaxSize;
 
   bool mInputState{false};
   bool mOutputState{false};
@@ -232,9 +287,84 @@ private:
   index mSilenceCount{0};
   bool  mInitialized{false};
 
-  ButterworthHPFilter mHiPass1;
-  ButterworthHPFilter mHiPass2;
+  BiquadCascade<2>    mHiPass;
   SlideUDFilter       mSlide;
 };
+
+// EnvelopeGate of several channels, one per row: the high-pass runs kLanes
+// channels at a time in the lanes of a BiquadCascade, and each channel then
+// has its own envelope, gate and look-ahead
+class MultiChannelEnvelopeGate
+{
+  static constexpr index kLanes = 4;
+
+public:
+  MultiChannelEnvelopeGate(index maxSize, index maxChannels)
+      : mLaneFilters(asUnsigned((maxChannels + kLanes - 1) / kLanes))
+  {
+    assert(maxChannels > 0);
+    mChannels.reserve(asUnsigned(maxChannels));
+    for (index i = 0; i < maxChannels; i++) mChannels.emplace_back(maxSize);
+  }
+
+  void init(double onThreshold, double offThreshold, double hiPassFreq,
+            index minTimeAboveThreshold, index upwardLookupTime,
+            index minTimeBelowThreshold, index downwardLookupTime)
+  {
+    for (auto& channel : mChannels)
+      channel.init(onThreshold, offThreshold, 0, minTimeAboveThreshold,
+                   upwardLookupTime, minTimeBelowThreshold,
+                   downwardLookupTime);
+    initFilters(hiPassFreq);
+    mHiPassFreq = hiPassFreq;
+  }
+
+  // as EnvelopeGate::process, for each row of in into the same row of out; in
+  // and out may be the same
+  void process(const RealMatrixView in, RealMatrixView out,
+               double onThreshold, double offThreshold, index rampUpTime,
+               index rampDownTime, double hiPassFreq, index minEventDuration,
+               index minSilenceDuration, bool approximateLog = false)
+  {
+    index channels = in.rows();
+    assert(channels <= asSigned(mChannels.size()));
+    assert(out.rows() == channels && out.cols() == in.cols());
+    if (hiPassFreq != mHiPassFreq)
+    {
+      initFilters(hiPassFreq);
+      mHiPassFreq = hiPassFreq;
+    }
+    if (mHiPassFreq > 0)
+    {
+      for (index c = 0; c < channels; c += kLanes)
+      {
+        index lanes = std::min(channels - c, index(kLanes));
+        mLaneFilters[asUnsigned(c / kLanes)].process(
+            in(Slice(c, lanes), Slice(0)), out(Slice(c, lanes), Slice(0)));
+      }
+    }
+    else
+      out = in;
+    for (index c = 0; c < channels; c++)
+      mChannels[asUnsigned(c)].process(
+          out.row(c), out.row(c), onThreshold, offThreshold, rampUpTime,
+          rampDownTime, 0, minEventDuration, minSilenceDuration,
+          approximateLog);
+  }
+
+  index getLatency() { return mChannels[0].getLatency(); }
+  bool  initialized() { return mChannels[0].initialized(); }
+
+private:
+  void initFilters(double cutoff)
+  {
+    BiquadCoefficients c = ButterworthHPFilter::coefficients(cutoff);
+    for (auto& filter : mLaneFilters) filter.init({{c, c}});
+  }
+
+  std::vector<EnvelopeGate>             mChannels;
+  std::vector<BiquadCascade<2, kLanes>> mLaneFilters;
+  double                                mHiPassFreq{0};
+};
 } // namespace algorithm
 } // namespace fluid
@@ -10,13 +10,18 @@ under the European Union’s Horizon 2020 research and innovation programme
 
 #pragma once
 
+#include "../util/BiquadCascade.hpp"
 #include "../util/ButterworthHPFilter.hpp"
+#include "../util/DecibelBlocks.hpp"
 #include "../util/FluidEigenMappings.hpp"
 #include "../util/SlideUDFilter.hpp"
 #include "../../data/FluidIndex.hpp"
 #include "../../data/TensorTypes.hpp"
 #include <Eigen/Core>
+#include <algorithm>
+#include <cassert>
 #include <cmath>
+#include <vector>
 
 namespace fluid {
 namespace algorithm {
@@ -46,20 +51,57 @@ public:
   {
     using namespace std;
     assert(mInitialized);
+    updateParams(fastRampUpTime, slowRampUpTime, fastRampDownTime,
+                 slowRampDownTime, hiPassFreq);
+    double filtered = in;
+    if (mHiPassFreq > 0){
+      filtered = mHiPass.processSample(in);
+    }
+    double rectified = abs(filtered);
+    double dB = 20 * log10(rectified);
+    double clipped = max(dB, floor);
+    return detect(clipped, onThreshold, offThreshold, debounce);
+  }
+
+  // detects onsets over a block of samples with the same parameters
+  // throughout, optionally with an approximate log10 (see fastLog10); in and
+  // out may be the same
+  void process(const RealVectorView in, RealVectorView out, double onThreshold,
+               double offThreshold, double floor, index fastRampUpTime,
+               index slowRampUpTime, index fastRampDownTime,
+               index slowRampDownTime, double hiPassFreq, index debounce,
+               bool approximateLog = false)
+  {
+    assert(mInitialized);
+    assert(in.size() == out.size());
+    updateParams(fastRampUpTime, slowRampUpTime, fastRampDownTime,
+                 slowRampDownTime, hiPassFreq);
+    DecibelBlocks::process(in, out, mHiPassFreq > 0 ? &mHiPass : nullptr,
+                           floor, approximateLog, [&](double dB) {
+                             return detect(dB, onThreshold, offThreshold,
+                                           debounce);
+                           });
+  }
+
+  bool initialized() { return mInitialized; }
+
+private:
+  void updateParams(index fastRampUpTime, index slowRampUpTime,
+                    index fastRampDownTime, index slowRampDownTime,
+                    double hiPassFreq)
+  {
     mFastSlide.updateCoeffs(fastRampUpTime, fastRampDownTime);
     mSlowSlide.updateCoeffs(slowRampUpTime, slowRampDownTime);
-    double filtered = in;
     if (hiPassFreq != mHiPassFreq)
     {
       initFilters(hiPassFreq);
       mHiPassFreq = hiPassFreq;
     }
-    if (mHiPassFreq > 0){
-      filtered = mHiPass2.processSample(mHiPass1.processSample(in));
-    }
-    double rectified = abs(filtered);
-    double dB = 20 * log10(rectified);
-    double clipped = max(dB, floor);
+  }
+
+  double detect(double clipped, double onThreshold, double offThreshold,
+                index debounce)
+  {
     double fast = mFastSlide.processSample(clipped);
     double slow = mSlowSlide.processSample(clipped);
     double value = fast - slow;
@@ -81,13 +123,10 @@ public:
     return detected;
   }
 
-  bool initialized() { return mInitialized; }
-
-private:
   void initFilters(double cutoff)
   {
-    mHiPass1.init(cutoff);
-    mHiPass2.init(cutoff);
+    BiquadCoefficients c = ButterworthHPFilter::coefficients(cutoff);
+    mHiPass.init({{c, c}});
   }
 
   double mHiPassFreq{0};
@@ -96,10 +135,79 @@ private:
   bool   mInitialized{false};
   bool   mState{false};
 
-  ButterworthHPFilter mHiPass1;
-  ButterworthHPFilter mHiPass2;
+  BiquadCascade<2>    mHiPass;
   SlideUDFilter       mFastSlide;
   SlideUDFilter       mSlowSlide;
 };
+
+// EnvelopeSegmentation of several channels, one per row: the high-pass runs
+// kLanes channels at a time in the lanes of a BiquadCascade, and each channel
+// then has its own envelopes and detector
+class MultiChannelEnvelopeSegmentation
+{
+  static constexpr index kLanes = 4;
+
+public:
+  MultiChannelEnvelopeSegmentation(index maxChannels)
+      : mChannels(asUnsigned(maxChannels)),
+        mLaneFilters(asUnsigned((maxChannels + kLanes - 1) / kLanes))
+  {
+    assert(maxChannels > 0);
+  }
+
+  void init(double floor, double hiPassFreq)
+  {
+    for (auto& channel : mChannels) channel.init(floor, 0);
+    initFilters(hiPassFreq);
+    mHiPassFreq = hiPassFreq;
+  }
+
+  // as EnvelopeSegmentation::process, for each row of in into the same row of
+  // out; in and out may be the same
+  void process(const RealMatrixView in, RealMatrixView out, double onThreshold,
+               double offThreshold, double floor, index fastRampUpTime,
+               index slowRampUpTime, index fastRampDownTime,
+               index slowRampDownTime, double hiPassFreq, index debounce,
+               bool approximateLog = false)
+  {
+    index channels = in.rows();
+    assert(channels <= asSigned(mChannels.size()));
+    assert(out.rows() == channels && out.cols() == in.cols());
+    if (hiPassFreq != mHiPassFreq)
+    {
+      initFilters(hiPassFreq);
+      mHiPassFreq = hiPassFreq;
+    }
+    if (mHiPassFreq > 0)
+    {
+      for (index c = 0; c < channels; c += kLanes)
+      {
+        index lanes = std::min(channels - c, index(kLanes));
+        mLaneFilters[asUnsigned(c / kLanes)].process(
+            in(Slice(c, lanes), Slice(0)), out(Slice(c, lanes), Slice(0)));
+      }
+    }
+    else
+      out = in;
+    for (index c = 0; c < channels; c++)
+      mChannels[asUnsigned(c)].process(
+          out.row(c), out.row(c), onThreshold, offThreshold, floor,
+          fastRampUpTime, slowRampUpTime, fastRampDownTime, slowRampDownTime, 0,
+          debounce, approximateLog);
+  }
+
+  bool initialized() { return mChannels[0].initialized(); }
+
+private:
+  void initFilters(double cutoff)
+  {
+    BiquadCoefficients c = ButterworthHPFilter::coefficients(cutoff);
+    for (auto& filter : mLaneFilters) filter.init({{c, c}});
+  }
+
+  std::vector<EnvelopeSegmentation>     mChannels;
+  std::vector<BiquadCascade<2, kLanes>> mLaneFilters;
+  double                                mHiPassFreq{0};
+};
 } // namespace algorithm
 } // namespace fluid
@@ -13,9 +13,13 @@ under the European Union’s Horizon 2020 research and innovation programme
 #include "../util/AlgorithmUtils.hpp"
 #include "../util/FluidEigenMappings.hpp"
 #include "../util/MedianFilter.hpp"
+#include "../util/ParallelFor.hpp"
 #include "../../data/FluidIndex.hpp"
 #include "../../data/TensorTypes.hpp"
 #include <Eigen/Core>
+#include <array>
+#include <cmath>
+#include <vector>
 
 namespace fluid {
 namespace algorithm {
@@ -26,32 +30,39 @@ public:
   using ArrayXXd = Eigen::ArrayXXd;
   using ArrayXXcd = Eigen::ArrayXXcd;
   using ArrayXcd = Eigen::ArrayXcd;
+  using ArrayXd = Eigen::ArrayXd;
 
   enum HPSSMode { kClassic, kCoupled, kAdvanced };
 
-  HPSS(index maxFFTSize, index maxHSize)
-      : mMaxH(maxFFTSize / 2 + 1, maxHSize),
-        mMaxV(maxFFTSize / 2 + 1, maxHSize),
-        mMaxBuf(maxFFTSize / 2 + 1, maxHSize)
+  HPSS(index maxFFTSize, index maxHSize, index maxVSize)
+      : mMaxBins(maxFFTSize / 2 + 1), mMaxVSize(maxVSize),
+        mH(mMaxBins, maxHSize), mV(mMaxBins, maxHSize),
+        mBuf(mMaxBins, maxHSize), mMag(mMaxBins),
+        mPadded(mMaxBins + maxVSize), mFiltered(mMaxBins + maxVSize),
+        mHarmonicMask(mMaxBins), mPercussiveMask(mMaxBins),
+        mResidualMask(mMaxBins), mMaskNorm(mMaxBins), mHThreshold(mMaxBins),
+        mPThreshold(mMaxBins)
   {
-    mMaxH.setZero();
-    mMaxV.setZero();
-    mMaxBuf.setZero();
+    mH.setZero();
+    mV.setZero();
+    mBuf.setZero();
   }
 
   void init(index nBins, index hSize)
   {
     using namespace Eigen;
     assert(hSize % 2);
-    assert(nBins <= mMaxBuf.rows());
-    assert(hSize <= mMaxBuf.cols());
+    assert(nBins <= mBuf.rows());
+    assert(hSize <= mBuf.cols());
 
-    mH = mMaxH.block(0, 0, nBins, hSize);
-    mV = mMaxV.block(0, 0, nBins, hSize);
-    mBuf = mMaxBuf.block(0, 0, nBins, hSize);
-    mH.setZero();
-    mV.setZero();
-    mBuf.setZero();
+    mBins = nBins;
+    mHSize = hSize;
+    mFrame = 0;
+    mH.topLeftCorner(nBins, hSize).setZero();
+    mV.topLeftCorner(nBins, hSize).setZero();
+    mBuf.topLeftCorner(nBins, hSize).setZero();
+    mHThresholdParams.fill(-1);
+    mPThresholdParams.fill(-1);
 
     mHFilters = std::vector<MedianFilter>(asUnsigned(nBins));
     for (index i = 0; i < nBins; i++) { mHFilters[asUnsigned(i)].init(hSize); }
@@ -66,65 +77,196 @@ public:
                     double pThresholdY2)
   {
     using namespace Eigen;
+    using namespace _impl;
     assert(mInitialized);
+    assert(hSize == mHSize && in.size() == mBins);
+    assert(vSize <= mMaxVSize);
 
+    // The history matrices are rings of hSize columns, written at mFrame.
+    // Reading back d columns gives the frame from d hops ago, which is what
+    // the matrices used to hold in column 0 after shifting left each hop:
+    // hSize - 1 hops for the spectrum and vertical medians, and h2 + 1 for
+    // the horizontal medians.
     index h2 = (hSize - 1) / 2;
-    index v2 = (vSize - 1) / 2;
-    index nBins = in.size();
-    ArrayXcd frame = _impl::asEigen<Array>(in);
-    ArrayXd  mag = frame.abs().real();
-
-    mV.block(0, 0, nBins, hSize - 1) = mV.block(0, 1, nBins, hSize - 1);
-    mH.block(0, 0, nBins, hSize - 1) = mH.block(0, 1, nBins, hSize - 1);
-    mBuf.block(0, 0, nBins, hSize - 1) = mBuf.block(0, 1, nBins, hSize - 1);
-
-    ArrayXd padded = ArrayXd::Zero(2 * vSize + nBins);
-    ArrayXd resultV = ArrayXd::Zero(padded.size());
-    ArrayXd tmp = ArrayXd::Zero(padded.size());
-
-    padded.segment(v2, nBins) = mag;
-    mVFilter.init(vSize);
-    for (index i = 0; i < padded.size(); i++)
-    { tmp(i) = mVFilter.processSample(padded(i)); }
-    mV.block(0, hSize - 1, nBins, 1) = tmp.segment(v2 * 3, nBins);
-    mBuf.block(0, hSize - 1, nBins, 1) = frame;
-    ArrayXd tmpRow = ArrayXd::Zero(2 * hSize);
+    index nBins = mBins;
+    index write = mFrame;
+    index readV = (mFrame + 1) % hSize;
+    index readH = (mFrame + hSize - (h2 + 1)) % hSize;
+    mFrame = (mFrame + 1) % hSize;
+
+    auto frame = asEigen<Array>(in).col(0);
+    auto mag = mMag.head(nBins);
+    mag = frame.abs();
+    mBuf.col(write).head(nBins) = frame;
+
+    // Once vSize samples have gone through the vertical filter, its earlier
+    // contents no longer matter, so it only needs resetting when vSize changes
+    if (mVFilter.size() != vSize) mVFilter.init(vSize);
+    verticalMedian(mVFilter, mag, mPadded, mFiltered,
+                   mV.col(write).head(nBins));
+
     for (index i = 0; i < nBins; i++)
-    { mH(i, h2 + 1) = mHFilters[asUnsigned(i)].processSample(mag(i)); }
-    ArrayXXcd result(nBins, 3);
-    ArrayXd   harmonicMask = ArrayXd::Ones(nBins);
-    ArrayXd   percussiveMask = ArrayXd::Ones(nBins);
-    ArrayXd   residualMask =
-        mode == kAdvanced ? ArrayXd::Ones(nBins) : ArrayXd::Zero(nBins);
+    { mH(i, write) = mHFilters[asUnsigned(i)].processSample(mag(i)); }
+
+    auto harmonicMask = mHarmonicMask.head(nBins);
+    auto percussiveMask = mPercussiveMask.head(nBins);
+    auto residualMask = mResidualMask.head(nBins);
+    makeMasks(mH.col(readH).head(nBins), mV.col(readV).head(nBins), mode,
+              cachedThreshold(mHThreshold, mHThresholdParams, hThresholdX1,
+                              hThresholdY1, hThresholdX2, hThresholdY2),
+              cachedThreshold(mPThreshold, mPThresholdParams, pThresholdX1,
+                              pThresholdY1, pThresholdX2, pThresholdY2),
+              harmonicMask, percussiveMask, residualMask,
+              mMaskNorm.head(nBins));
+    auto buf = mBuf.col(readV).head(nBins);
+    auto result = asFluid<Array>(out);
+    result.col(0) = buf * harmonicMask.min(1.0);
+    result.col(1) = buf * percussiveMask.min(1.0);
+    result.col(2) = buf * residualMask.min(1.0);
+  }
+
+  /**
+   Offline counterpart to processFrame, over a whole spectrogram (frames x
+   bins). Frame j of each output is what processFrame gives hSize - 1 calls
+   after being passed frame j, with frames past the end of in taken as
+   silence, so the two agree exactly (the harmonic medians are centred on
+   frame j - 1 in both). The horizontal medians run across bins, and the
+   vertical medians and masking across frames, on up to nThreads threads.
+   Needs two real matrices the size of in as working memory.
+   **/
+  static void processSpectrogram(
+      const ComplexMatrixView in, ComplexMatrixView harmonic,
+      ComplexMatrixView percussive, ComplexMatrixView residual, index vSize,
+      index hSize, index mode, double hThresholdX1, double hThresholdY1,
+      double hThresholdX2, double hThresholdY2, double pThresholdX1,
+      double pThresholdY1, double pThresholdX2, double pThresholdY2,
+      index nThreads = defaultThreadCount())
+  {
+    using namespace Eigen;
+    using namespace _impl;
+    index nFrames = in.rows();
+    index nBins = in.cols();
+    index h2 = (hSize - 1) / 2;
+    index v2 = (vSize - 1) / 2;
+    auto  input = ComplexMatrixView(in); // rows of in would be const
+
+    // bins x frames, so that each frame is contiguous
+    ArrayXXd mag(nBins, nFrames);
+    ArrayXXd hMedian(nBins, nFrames);
+    ArrayXd  hThreshold(nBins);
+    ArrayXd  pThreshold(nBins);
+    makeThreshold(hThreshold, hThresholdX1, hThresholdY1, hThresholdX2,
+                  hThresholdY2);
+    makeThreshold(pThreshold, pThresholdX1, pThresholdY1, pThresholdX2,
+                  pThresholdY2);
+
+    parallelFor(
+        nFrames,
+        [&](index j) {
+          auto frame = input.row(j);
+          mag.col(j) = asEigen<Array>(frame).col(0).abs();
+        },
+        nThreads);
+
+    // when streaming, frame j is masked with the medians output h2 - 1
+    // frames later
+    parallelFor(
+        nBins,
+        [&](index i) {
+          MedianFilter filter;
+          filter.init(hSize);
+          for (index t = 0; t < nFrames + h2 - 1; ++t)
+          {
+            double m = filter.processSample(t < nFrames ? mag(i, t) : 0);
+            if (t >= h2 - 1) hMedian(i, t - h2 + 1) = m;
+          }
+        },
+        nThreads);
+
+    index nChunks = std::min(nFrames, 4 * nThreads);
+    parallelFor(
+        nChunks,
+        [&](index chunk) {
+          MedianFilter filter;
+          ArrayXd      padded(nBins + 2 * v2);
+          ArrayXd      filtered(nBins + 2 * v2);
+          ArrayXd      vMedian(nBins);
+          ArrayXd      harmonicMask(nBins);
+          ArrayXd      percussiveMask(nBins);
+          ArrayXd      residualMask(nBins);
+          ArrayXd      maskNorm(nBins);
+          filter.init(vSize);
+          for (index j = chunk * nFrames / nChunks;
+               j < (chunk + 1) * nFrames / nChunks; ++j)
+          {
+            verticalMedian(filter, mag.col(j), padded, filtered, vMedian);
+            makeMasks(hMedian.col(j), vMedian, mode, hThreshold, pThreshold,
+                      harmonicMask, percussiveMask, residualMask, maskNorm);
+            auto row = input.row(j);
+            auto frame = asEigen<Array>(row).col(0);
+            auto h = harmonic.row(j);
+            auto p = percussive.row(j);
+            auto r = residual.row(j);
+            asFluid<Array>(h).col(0) = frame * harmonicMask.min(1.0);
+            asFluid<Array>(p).col(0) = frame * percussiveMask.min(1.0);
+            asFluid<Array>(r).col(0) = frame * residualMask.min(1.0);
+          }
+        },
+        nThreads);
+  }
+
+  bool initialized() { return mInitialized; }
+
+private:
+  using ArrayRef = Eigen::Ref<Eigen::ArrayXd>;
+  using ConstArrayRef = const Eigen::Ref<const Eigen::ArrayXd>&;
+
+  // Median across bins, centred v2 bins above each one. The filter's output
+  // is only taken once it has been fed vSize samples, so its prior state
+  // doesn't matter.
+  static void verticalMedian(MedianFilter& filter, ConstArrayRef mag,
+                             ArrayRef padded, ArrayRef filtered, ArrayRef out)
+  {
+    index nBins = mag.size();
+    index v2 = (filter.size() - 1) / 2;
+    index nPadded = nBins + 2 * v2;
+    padded.head(nBins) = mag;
+    padded.segment(nBins, 2 * v2).setZero();
+    filter.process(RealVectorView(padded.data(), 0, nPadded),
+                   RealVectorView(filtered.data(), 0, nPadded));
+    out = filtered.segment(2 * v2, nBins);
+  }
+
+  static void makeMasks(ConstArrayRef H, ConstArrayRef V, index mode,
+                        ConstArrayRef hThreshold, ConstArrayRef pThreshold,
+                        ArrayRef harmonicMask, ArrayRef percussiveMask,
+                        ArrayRef residualMask, ArrayRef maskNorm)
+  {
+    harmonicMask.setOnes();
+    percussiveMask.setOnes();
+    if (mode == kAdvanced)
+      residualMask.setOnes();
+    else
+      residualMask.setZero();
     switch (mode)
     {
     case kClassic: {
-      ArrayXd HV = mH.col(0) + mV.col(0);
-      ArrayXd mult = (1.0 / HV.max(epsilon));
-      harmonicMask = (mH.col(0) * mult);
-      percussiveMask = (mV.col(0) * mult);
+      maskNorm = 1.0 / (H + V).max(epsilon);
+      harmonicMask = H * maskNorm;
+      percussiveMask = V * maskNorm;
       break;
     }
     case kCoupled: {
-      harmonicMask = ((mH.col(0) / mV.col(0)) >
-                      makeThreshold(nBins, hThresholdX1, hThresholdY1,
-                                    hThresholdX2, hThresholdY2))
-                         .cast<double>();
+      harmonicMask = ((H / V) > hThreshold).cast<double>();
       percussiveMask = 1 - harmonicMask;
       break;
     }
     case kAdvanced: {
-      harmonicMask = ((mH.col(0) / mV.col(0)) >
-                      makeThreshold(nBins, hThresholdX1, hThresholdY1,
-                                    hThresholdX2, hThresholdY2))
-                         .cast<double>();
-      percussiveMask = ((mV.col(0) / mH.col(0)) >
-                        makeThreshold(nBins, pThresholdX1, pThresholdY1,
-                                      pThresholdX2, pThresholdY2))
-                           .cast<double>();
+      harmonicMask = ((H / V) > hThreshold).cast<double>();
+      percussiveMask = ((V / H) > pThreshold).cast<double>();
       residualMask = residualMask * (1 - harmonicMask);
       residualMask = residualMask * (1 - percussiveMask);
-      ArrayXd maskNorm =
+      maskNorm =
           (1. / (harmonicMask + percussiveMask + residualMask)).max(epsilon);
       harmonicMask = harmonicMask * maskNorm;
       percussiveMask = percussiveMask * maskNorm;
@@ -132,22 +274,16 @@ public:
       break;
     }
     }
-    result.col(0) = mBuf.col(0) * harmonicMask.min(1.0);
-    result.col(1) = mBuf.col(0) * percussiveMask.min(1.0);
-    result.col(2) = mBuf.col(0) * residualMask.min(1.0);
-    out = _impl::asFluid(result);
   }
-  bool initialized() { return mInitialized; }
 
-private:
-  Eigen::ArrayXd makeThreshold(index nBins, double x1, double y1, double x2,
-                               double y2)
+  static void makeThreshold(ArrayRef threshold, double x1, double y1,
+                            double x2, double y2)
   {
     using namespace Eigen;
-    ArrayXd threshold = ArrayXd::Ones(nBins);
-    index   kneeStart = static_cast<index>(std::floor(x1 * nBins));
-    index   kneeEnd = static_cast<index>(std::floor(x2 * nBins));
-    index   kneeLength = kneeEnd - kneeStart;
+    index nBins = threshold.size();
+    index kneeStart = static_cast<index>(std::floor(x1 * nBins));
+    index kneeEnd = static_cast<index>(std::floor(x2 * nBins));
+    index kneeLength = kneeEnd - kneeStart;
     threshold.segment(0, kneeStart) =
         ArrayXd::Constant(kneeStart, 10).pow(y1 / 20.0);
     threshold.segment(kneeStart, kneeLength) =
@@ -155,19 +291,47 @@ private:
             .pow(ArrayXd::LinSpaced(kneeLength, y1, y2) / 20.0);
     threshold.segment(kneeEnd, nBins - kneeEnd) =
         ArrayXd::Constant(nBins - kneeEnd, 10).pow(y2 / 20.0);
-    return threshold;
+  }
+
+  // the threshold for the current bins, only rebuilt when the knee changes
+  ArrayRef cachedThreshold(Eigen::ArrayXd& threshold,
+                           std::array<double, 4>& cached, double x1, double y1,
+                           double x2, double y2)
+  {
+    auto t = threshold.head(mBins);
+    if (cached != std::array<double, 4>{{x1, y1, x2, y2}})
+    {
+      cached = {{x1, y1, x2, y2}};
+      makeThreshold(t, x1, y1, x2, y2);
+    }
+    return t;
   }
 
   std::vector<MedianFilter> mHFilters;
   MedianFilter              mVFilter;
 
-  ArrayXXd  mMaxH;
-  ArrayXXd  mMaxV;
-  ArrayXXcd mMaxBuf;
-  ArrayXXd  mV;
+  index     mMaxBins;
+  index     mMaxVSize;
+  index     mBins{0};
+  index     mHSize{0};
+  index     mFrame{0};
   ArrayXXd  mH;
+  ArrayXXd  mV;
   ArrayXXcd mBuf;
-  bool      mInitialized{false};
+  ArrayXd   mMag;
+  ArrayXd   mPadded;
+  ArrayXd   mFiltered;
+  ArrayXd   mHarmonicMask;
+  ArrayXd   mPercussiveMask;
+  ArrayXd   mResidualMask;
+  ArrayXd   mMaskNorm;
+  ArrayXd   mHThreshold;
+  ArrayXd   mPThreshold;
+
+  std::array<double, 4> mHThresholdParams;
+  std::array<double, 4> mPThresholdParams;
+
+  bool mInitialized{false};
 };
 } // namespace algorithm
 } // namespace fluid
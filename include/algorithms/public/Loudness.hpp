@@ -11,27 +11,43 @@ under the European Union’s Horizon 2020 research and innovation programme
 #pragma once
 
 #include "../util/AlgorithmUtils.hpp"
+#include "../util/BiquadCascade.hpp"
 #include "../util/FluidEigenMappings.hpp"
 #include "../util/KWeightingFilter.hpp"
 #include "../util/TruePeak.hpp"
 #include "../../data/FluidIndex.hpp"
 #include "../../data/TensorTypes.hpp"
 #include <Eigen/Core>
+#include <algorithm>
+#include <cassert>
 #include <cmath>
+#include <vector>
 
 namespace fluid {
 namespace algorithm {
 
 class Loudness
 {
+  // channels filtered together by the multichannel processFrame
+  static constexpr index kLanes = 4;
 
 public:
-  Loudness(index maxSize) : mTP(maxSize) {}
+  Loudness(index maxSize, index maxChannels = 1)
+      : mFiltered(maxSize), mFilteredFrames(maxChannels, maxSize),
+        mLaneFilters(asUnsigned((maxChannels + kLanes - 1) / kLanes)),
+        mMaxChannels(maxChannels)
+  {
+    assert(maxChannels > 0);
+    mTP.reserve(asUnsigned(maxChannels));
+    for (index i = 0; i < maxChannels; i++) mTP.emplace_back(maxSize);
+  }
 
-  void init(index size, double sampleRate)
+  void init(index size, index hopSize, double sampleRate)
   {
     mFilter.init(sampleRate);
-    mTP.init(size, sampleRate);
+    for (auto& filter : mLaneFilters)
+      filter.init(KWeightingFilter::coefficients(sampleRate));
+    for (auto& tp : mTP) tp.init(size, hopSize, sampleRate);
     mSize = size;
     mInitialized = true;
   }
@@ -40,26 +56,73 @@ public:
                     bool weighting, bool truePeak)
   {
     using namespace Eigen;
-    using namespace std;
     assert(mInitialized);
     assert(output.size() == 2);
     assert(input.size() == mSize);
-    ArrayXd in = _impl::asEigen<Array>(input);
-    ArrayXd filtered(mSize);
-    for (index i = 0; i < mSize; i++)
-      filtered(i) = weighting ? mFilter.processSample(in(i)) : in(i);
+    auto in = _impl::asEigen<Array>(input).col(0);
+    auto filtered = mFiltered.head(mSize);
+    filtered = in;
+    if (weighting) mFilter.process(filtered.data(), filtered.data(), mSize);
+    describe(input, filtered, mTP[0], truePeak, output);
+  }
+
+  // one channel per row of input, K-weighted kLanes channels at a time;
+  // output has the loudness and peak of each channel in the same row
+  void processFrame(RealMatrixView input, RealMatrixView output,
+                    bool weighting, bool truePeak)
+  {
+    using namespace Eigen;
+    assert(mInitialized);
+    index channels = input.rows();
+    assert(channels <= mMaxChannels && input.cols() == mSize);
+    assert(output.rows() == channels && output.cols() == 2);
+    RealMatrixView filtered =
+        mFilteredFrames(Slice(0, channels), Slice(0, mSize));
+    if (weighting)
+    {
+      for (index c = 0; c < channels; c += kLanes)
+      {
+        index lanes = std::min(channels - c, index(kLanes));
+        mLaneFilters[asUnsigned(c / kLanes)].process(
+            input(Slice(c, lanes), Slice(0)),
+            filtered(Slice(c, lanes), Slice(0)));
+      }
+    }
+    else
+      filtered = input;
+    for (index c = 0; c < channels; c++)
+    {
+      RealVectorView filteredChannel = filtered.row(c);
+      describe(input.row(c), _impl::asEigen<Array>(filteredChannel).col(0),
+               mTP[asUnsigned(c)], truePeak, output.row(c));
+    }
+  }
+
+private:
+  template <typename Filtered>
+  void describe(const RealVectorView input, const Filtered& filtered,
+                TruePeak& tp, bool truePeak, RealVectorView output)
+  {
+    using namespace Eigen;
+    using namespace std;
     double loudness = -0.691 + 10 * log10(filtered.square().mean() + epsilon);
-    double peak = truePeak ? mTP.processFrame(input) : in.abs().maxCoeff();
+    if (!truePeak) tp.reset();
+    double peak = truePeak
+                      ? tp.processFrame(input)
+                      : _impl::asEigen<Array>(input).abs().maxCoeff();
     peak = 20 * log10(peak + epsilon);
     output(0) = loudness;
     output(1) = peak;
   }
 
-private:
-  TruePeak         mTP;
-  KWeightingFilter mFilter;
-  index            mSize{1024};
-  bool             mInitialized{false};
+  std::vector<TruePeak>                 mTP;
+  KWeightingFilter                      mFilter;
+  Eigen::ArrayXd                        mFiltered;
+  RealMatrix                            mFilteredFrames;
+  std::vector<BiquadCascade<2, kLanes>> mLaneFilters;
+  index                                 mMaxChannels;
+  index                                 mSize{1024};
+  bool                                  mInitialized{false};
 };
 
 } // namespace algorithm
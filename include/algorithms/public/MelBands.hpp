@@ -12,19 +12,35 @@ under the European Union’s Horizon 2020 research and innovation programme
 #include "../util/AlgorithmUtils.hpp"
 #include "../util/FluidEigenMappings.hpp"
 #include "../../data/FluidIndex.hpp"
+#include "../../data/TensorTypes.hpp"
 #include <Eigen/Core>
 #include <cassert>
 #include <cmath>
+#include <vector>
 
 namespace fluid {
 namespace algorithm {
 
+/**
+ Triangular mel filterbank. Each filter is stored as the span of bins it
+ covers, so applying the bank costs about two multiplies per bin, whatever
+ the number of bands.
+ **/
 class MelBands
 {
+  using ArrayXd = Eigen::ArrayXd;
+  using ArrayXXd = Eigen::ArrayXXd;
+
 public:
-  MelBands(index maxBands, index maxFFT)
-      : mFiltersStorage(maxBands, maxFFT / 2 + 1)
-  {}
+  // maxFrames bounds the number of frames given at once to processFrames()
+  MelBands(index maxBands, index maxFFT, index maxFrames = 1)
+      : mFrame(maxFFT / 2 + 1), mResult(maxBands),
+        mWeights(2 * (maxFFT / 2 + 1) + 2 * maxBands),
+        mFrames(maxFrames, maxFFT / 2 + 1), mBands(maxFrames, maxBands),
+        mEnergy(maxFrames)
+  {
+    mSpans.reserve(asUnsigned(maxBands));
+  }
 
   /*static inline double mel2hz(double x) {
       return 700.0 * (exp(x / 1127.01048) - 1.0);
@@ -47,35 +63,45 @@ public:
     mScale2 = 1.0 / (2.0 * double(fftSize) / windowSize);
     ArrayXd melFreqs = ArrayXd::LinSpaced(nBands + 2, hz2mel(lo), hz2mel(hi));
     melFreqs = 700.0 * ((melFreqs / 1127.01048).exp() - 1.0);
-    mFilters = mFiltersStorage.block(0, 0, nBands, nBins);
-    mFilters.setZero();
     ArrayXd fftFreqs = ArrayXd::LinSpaced(nBins, 0, sampleRate / 2.0);
     ArrayXd melD =
         (melFreqs.segment(0, nBands + 1) - melFreqs.segment(1, nBands + 1))
             .abs();
-    ArrayXXd ramps = melFreqs.replicate(1, nBins);
-    ramps.rowwise() -= fftFreqs.transpose();
+    ArrayXd filter(nBins);
+    mSpans.clear();
+    index offset = 0;
     for (index i = 0; i < nBands; i++)
     {
-      ArrayXd lower = -ramps.row(i) / melD(i);
-      ArrayXd upper = ramps.row(i + 2) / melD(i + 1);
-      mFilters.row(i) = lower.min(upper).max(0);
+      filter = ((fftFreqs - melFreqs(i)) / melD(i))
+                   .min((melFreqs(i + 2) - fftFreqs) / melD(i + 1))
+                   .max(0);
+      index start = 0, end = nBins;
+      while (start < end && filter(start) == 0) start++;
+      while (end > start && filter(end - 1) == 0) end--;
+      index size = end - start;
+      if (offset + size > mWeights.size())
+        mWeights.conservativeResize(2 * (offset + size));
+      mWeights.segment(offset, size) = filter.segment(start, size);
+      mSpans.push_back({start, size, offset});
+      offset += size;
     }
+    mNBins = nBins;
   }
 
   void processFrame(const RealVectorView in, RealVectorView out, bool magNorm,
                     bool usePower, bool logOutput)
   {
     using namespace Eigen;
-
-    ArrayXd frame = _impl::asEigen<Eigen::Array>(in);
+    assert(in.size() == mNBins && out.size() == asSigned(mSpans.size()));
+    index nBands = asSigned(mSpans.size());
+    auto  frame = mFrame.head(mNBins);
+    auto  result = mResult.head(nBands);
+    frame = _impl::asEigen<Array>(in);
     if (magNorm) frame = frame * mScale1;
-    ArrayXd result;
-    if (usePower) { result = (mFilters * frame.square().matrix()).array(); }
+    if (usePower)
+      apply(frame.square(), result);
     else
-    {
-      result = (mFilters * frame.matrix()).array();
-    }
+      apply(frame, result);
     if (magNorm)
     {
       double energy = frame.sum() * mScale2;
@@ -83,14 +109,76 @@ public:
     }
 
     if (logOutput) result = 10 * result.max(epsilon).log10();
-    out = _impl::asFluid(result);
+    _impl::asFluid<Array>(out) = result;
+  }
+
+  // processFrame() on each row of a frames x bins matrix, into the rows of a
+  // frames x bands matrix, of at most maxFrames rows
+  void processFrames(const RealMatrixView in, RealMatrixView out,
+                     bool magNorm, bool usePower, bool logOutput)
+  {
+    using namespace Eigen;
+    assert(in.cols() == mNBins && out.cols() == asSigned(mSpans.size()));
+    assert(in.rows() == out.rows() && in.rows() <= mFrames.rows());
+    index nFrames = in.rows();
+    index nBands = asSigned(mSpans.size());
+    auto  frames = mFrames.topLeftCorner(nFrames, mNBins);
+    auto  result = mBands.topLeftCorner(nFrames, nBands);
+    auto  energy = mEnergy.head(nFrames);
+    frames = _impl::asEigen<Array>(in);
+    if (magNorm)
+    {
+      frames *= mScale1;
+      energy = frames.rowwise().sum() * mScale2;
+    }
+    if (usePower) frames = frames.square();
+    for (index i = 0; i < nBands; i++)
+    {
+      const Span& s = mSpans[asUnsigned(i)];
+      result.col(i).matrix().noalias() =
+          frames.middleCols(s.start, s.size).matrix() *
+          mWeights.segment(s.offset, s.size).matrix();
+    }
+    if (magNorm)
+    {
+      energy /= result.rowwise().sum().max(epsilon);
+      result.colwise() *= energy;
+    }
+    if (logOutput) result = 10 * result.max(epsilon).log10();
+    _impl::asFluid<Array>(out) = result;
   }
 
   double mScale1{1.0};
   double mScale2{1.0};
 
-  Eigen::MatrixXd mFilters;
-  Eigen::MatrixXd mFiltersStorage;
+private:
+  struct Span
+  {
+    index start;  // first bin
+    index size;   // number of bins
+    index offset; // position of the weights in mWeights
+  };
+
+  template <typename Frame, typename Result>
+  void apply(const Frame& frame, Result& result)
+  {
+    for (index i = 0; i < asSigned(mSpans.size()); i++)
+    {
+      const Span& s = mSpans[asUnsigned(i)];
+      result(i) = (frame.segment(s.start, s.size) *
+                   mWeights.segment(s.offset, s.size))
+                      .sum();
+    }
+  }
+
+  index             mNBins{0};
+  ArrayXd           mFrame;
+  ArrayXd           mResult;
+  ArrayXd           mWeights;
+  ArrayXXd          mFrames;
+  ArrayXXd          mBands;
+  ArrayXd           mEnergy;
+  std::vector<Span> mSpans;
 };
 } // namespace algorithm
 } // namespace fluid
@@ -0,0 +1,113 @@
+/*
+Part of the Fluid Corpus Manipulation Project (http://www.flucoma.org/)
+Copyright 2017-2019 University of Huddersfield.
+Licensed under the BSD-3 License.
+See license.md file in the project root for full license information.
+This project has received funding from the European Research Council (ERC)
+under the European Union’s Horizon 2020 research and innovation programme
+(grant agreement No 725899).
+*/
+
+#pragma once
+
+#include "../util/AlgorithmUtils.hpp"
+#include "../util/FluidEigenMappings.hpp"
+#include "../../data/FluidIndex.hpp"
+#include "../../data/TensorTypes.hpp"
+#include <Eigen/Core>
+#include <cassert>
+
+namespace fluid {
+namespace algorithm {
+
+/**
+ Real-time counterpart to NMF::processFrame: the normalised dictionary, its
+ transpose and column sums are cached between frames and only recomputed by
+ setDictionary(), and each frame's activations are warm-started from the
+ previous ones. All storage is allocated up front, so processFrame() does not
+ touch the heap.
+ **/
+class NMFFrameSolver
+{
+  using MatrixXd = Eigen::MatrixXd;
+  using VectorXd = Eigen::VectorXd;
+
+public:
+  NMFFrameSolver(index maxRank, index maxBins)
+      : mW(maxBins, maxRank), mWT(maxRank, maxBins), mWSum(maxRank),
+        mH(maxRank), mHNum(maxRank), mV(maxBins), mR(maxBins)
+  {}
+
+  // W0 is rank x nBins, as stored in a bases buffer
+  void setDictionary(const RealMatrixView W0)
+  {
+    using namespace Eigen;
+    using namespace _impl;
+    assert(W0.extent(0) <= mW.cols() && W0.extent(1) <= mW.rows());
+    mRank = W0.extent(0);
+    mBins = W0.extent(1);
+    auto W = mW.topLeftCorner(mBins, mRank);
+    W = asEigen<Matrix>(W0).transpose().cwiseMax(epsilon);
+    for (index i = 0; i < mRank; ++i) W.col(i).normalize();
+    mWT.topLeftCorner(mRank, mBins) = W.transpose();
+    mWSum.head(mRank) = W.colwise().sum().transpose().cwiseMax(epsilon);
+    reset();
+  }
+
+  // forget the warm start, e.g. on a transport reset
+  void reset() { mH.head(mRank).setConstant(0.5); }
+
+  index rank() const { return mRank; }
+  index nBins() const { return mBins; }
+
+  void processFrame(const RealVectorView x, RealVectorView out,
+                    index          nIterations = 10,
+                    RealVectorView v = RealVectorView(nullptr, 0, 0))
+  {
+    using namespace Eigen;
+    using namespace _impl;
+    assert(x.extent(0) == mBins && out.extent(0) == mRank);
+    auto W = mW.topLeftCorner(mBins, mRank);
+    auto WT = mWT.topLeftCorner(mRank, mBins);
+    auto wSum = mWSum.head(mRank);
+    auto h = mH.head(mRank);
+    auto hNum = mHNum.head(mRank);
+    auto v0 = mV.head(mBins);
+    auto r = mR.head(mBins);
+
+    v0 = asEigen<Matrix>(x).col(0).cwiseMax(epsilon);
+    h = h.cwiseMax(epsilon);
+    while (nIterations--)
+    {
+      r.noalias() = W * h;
+      r = v0.cwiseQuotient(r.cwiseMax(epsilon));
+      hNum.noalias() = WT * r;
+      h = h.cwiseProduct(hNum).cwiseQuotient(wSum);
+    }
+    asFluid<Matrix>(out) = h;
+    if (v.extent(0) > 0) asFluid<Matrix>(v).noalias() = W * h;
+  }
+
+  // the spectrum contributed by one component on the last frame
+  void estimate(index component, RealVectorView out)
+  {
+    using namespace Eigen;
+    using namespace _impl;
+    assert(component < mRank && out.extent(0) == mBins);
+    asFluid<Matrix>(out) =
+        mW.col(component).head(mBins) * mH(component);
+  }
+
+private:
+  index    mRank{0};
+  index    mBins{0};
+  MatrixXd mW;
+  MatrixXd mWT;
+  VectorXd mWSum;
+  VectorXd mH;
+  VectorXd mHNum;
+  VectorXd mV;
+  VectorXd mR;
+};
+} // namespace algorithm
+} // namespace fluid
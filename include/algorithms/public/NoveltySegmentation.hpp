@@ -42,7 +42,8 @@ public:
   double processFrame(const RealVectorView input, double threshold,
                       index minSliceLength)
   {
-    double novelty = mNovelty.processFrame(_impl::asEigen<Eigen::Array>(input));
+    double novelty =
+        mNovelty.processFrame(_impl::asEigen<Eigen::Array>(input).col(0));
     double detected = 0.;
     index  filterSize = mFilterBuffer.size();
     if (filterSize > 1)
@@ -0,0 +1,149 @@
+/*
+Part of the Fluid Corpus Manipulation Project (http://www.flucoma.org/)
+Copyright 2017-2019 University of Huddersfield.
+Licensed under the BSD-3 License.
+See license.md file in the project root for full license information.
+This project has received funding from the European Research Council (ERC)
+under the European Union’s Horizon 2020 research and innovation programme
+(grant agreement No 725899).
+*/
+
+#pragma once
+
+#include "../util/AlgorithmUtils.hpp"
+#include "../util/FluidEigenMappings.hpp"
+#include "../../data/FluidIndex.hpp"
+#include "../../data/TensorTypes.hpp"
+#include <Eigen/Core>
+
+namespace fluid {
+namespace algorithm {
+
+/**
+ Online (mini-batch) KL-NMF, after Lefèvre, Bach & Févotte (2011), "Online
+ algorithms for nonnegative matrix factorization with the Itakura-Saito
+ divergence", adapted to the KL updates used by NMF.
+
+ The bases are refined from running sufficient statistics (A, B) rather than
+ from the whole of V, so memory is bounded by the rank, the number of bins
+ and the largest batch, whatever the length of the material.
+ **/
+class OnlineNMF
+{
+
+public:
+  void init(index nBins, index rank, index maxBatchSize)
+  {
+    using namespace Eigen;
+    mW = MatrixXd::Random(nBins, rank) * 0.5 +
+         MatrixXd::Constant(nBins, rank, 0.5);
+    mW = mW.array().max(epsilon).matrix();
+    mW.colwise().normalize();
+    allocate(nBins, rank, maxBatchSize);
+  }
+
+  void init(const RealMatrixView W0, index maxBatchSize)
+  {
+    using namespace Eigen;
+    using namespace _impl;
+    mW = asEigen<Matrix>(W0).transpose();
+    mW = mW.array().max(epsilon).matrix();
+    mW.colwise().normalize();
+    allocate(W0.extent(1), W0.extent(0), maxBatchSize);
+  }
+
+  // forgetting factor applied to the statistics before each batch: 1 keeps
+  // everything seen so far, smaller values let the bases track changes
+  void setForgetting(double rho) { mRho = rho; }
+
+  index rank() const { return mW.cols(); }
+  index nBins() const { return mW.rows(); }
+
+  // X is a batch of magnitude frames (nFrames x nBins), H1 receives the
+  // activations (nFrames x rank) estimated against the current bases
+  void processBatch(const RealMatrixView X, RealMatrixView H1,
+                    index nIterations, bool updateW = true)
+  {
+    using namespace Eigen;
+    using namespace _impl;
+    index nFrames = X.extent(0);
+    assert(nFrames <= mMaxBatchSize);
+    assert(X.extent(1) == nBins());
+    assert(H1.extent(0) == nFrames && H1.extent(1) == rank());
+
+    auto V = mV.leftCols(nFrames);
+    auto H = mH.leftCols(nFrames);
+    auto R = mR.leftCols(nFrames);
+
+    V = asEigen<Matrix>(X).transpose().array().max(epsilon).matrix();
+    H = MatrixXd::Random(rank(), nFrames) * 0.5 +
+        MatrixXd::Constant(rank(), nFrames, 0.5);
+    H = H.array().max(epsilon).matrix();
+    mWSum = mW.colwise().sum().transpose().array().max(epsilon);
+
+    for (index i = 0; i < nIterations; ++i)
+    {
+      R.noalias() = mW * H;
+      R = V.array() / R.array().max(epsilon);
+      mHNum.leftCols(nFrames).noalias() = mW.transpose() * R;
+      H = (H.array() * mHNum.leftCols(nFrames).array()).colwise() / mWSum;
+    }
+
+    if (updateW)
+    {
+      R.noalias() = mW * H;
+      R = V.array() / R.array().max(epsilon);
+      mWNum.noalias() = R * H.transpose();
+      mA = mRho * mA + (mWNum.array() * mW.array()).matrix();
+      mB = mRho * mB + H.rowwise().sum().array();
+      mW = (mA.array().rowwise() / mB.max(epsilon).transpose()).matrix();
+      mW = mW.array().max(epsilon).matrix();
+      mW.colwise().normalize();
+    }
+
+    mHT = H.transpose();
+    H1 = asFluid(mHT);
+  }
+
+  // writes the current bases as rank x nBins
+  void getBases(RealMatrixView W1)
+  {
+    using namespace _impl;
+    mWT = mW.transpose();
+    W1 = asFluid(mWT);
+  }
+
+private:
+  using MatrixXd = Eigen::MatrixXd;
+  using ArrayXd = Eigen::ArrayXd;
+
+  void allocate(index nBins, index rank, index maxBatchSize)
+  {
+    mMaxBatchSize = maxBatchSize;
+    mA = MatrixXd::Zero(nBins, rank);
+    mB = ArrayXd::Zero(rank);
+    mWNum.resize(nBins, rank);
+    mWSum.resize(rank);
+    mV.resize(nBins, maxBatchSize);
+    mR.resize(nBins, maxBatchSize);
+    mH.resize(rank, maxBatchSize);
+    mHNum.resize(rank, maxBatchSize);
+    mHT.resize(maxBatchSize, rank);
+  }
+
+  index    mMaxBatchSize{0};
+  double   mRho{1.0};
+  MatrixXd mW;
+  MatrixXd mWT;
+  MatrixXd mA;
+  ArrayXd  mB;
+  MatrixXd mWNum;
+  ArrayXd  mWSum;
+  MatrixXd mV;
+  MatrixXd mR;
+  MatrixXd mH;
+  MatrixXd mHNum;
+  MatrixXd mHT;
+};
+} // namespace algorithm
+} // namespace fluid
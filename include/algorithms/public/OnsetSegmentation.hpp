@@ -19,6 +19,7 @@ under the European Union’s Horizon 2020 research and innovation programme
 #include "../../data/TensorTypes.hpp"
 #include <Eigen/Eigen>
 #include <algorithm>
+#include <array>
 #include <cassert>
 
 namespace fluid {
@@ -31,13 +32,18 @@ public:
   using ArrayXd = Eigen::ArrayXd;
   using ArrayXcd = Eigen::ArrayXcd;
 
-  OnsetSegmentation(index maxSize) : mFFT(maxSize), mWindowStorage(maxSize) {}
+  OnsetSegmentation(index maxSize)
+      : mFFT(maxSize), mWindowStorage(maxSize), mWindowed(maxSize)
+  {
+    for (auto& f : mFrames) f.init(maxSize / 2 + 1);
+    mDeltaFrame.init(maxSize / 2 + 1);
+  }
 
   void init(index windowSize, index fftSize)
   {
     makeWindow(windowSize);
-    prevFrame = ArrayXcd::Zero(fftSize / 2 + 1);
-    prevPrevFrame = ArrayXcd::Zero(fftSize / 2 + 1);
+    for (auto& f : mFrames) f.reset(fftSize / 2 + 1);
+    mCurrent = 0;
     mFFT.resize(fftSize);
     mDebounceCount = 1;
     mPrevFuncVal = 0;
@@ -57,34 +63,36 @@ public:
                       index frameDelta = 0)
   {
     assert(mInitialized);
-    ArrayXd in = _impl::asEigen<Eigen::Array>(input);
-    double  funcVal = 0;
+    auto   in = _impl::asEigen<Eigen::Array>(input).col(0);
+    double funcVal = 0;
     double  filteredFuncVal = 0;
     double  detected = 0.;
     if (filterSize >= 3 &&
         (!mFilter.initialized() || filterSize != mFilter.size()))
       mFilter.init(filterSize);
 
-    ArrayXcd frame = mFFT.process(in.segment(0, mWindowSize) * mWindow);
-    auto     odf = static_cast<OnsetDetectionFuncs::ODF>(function);
+    // the three most recent frames, in a ring
+    Frame& frame = mFrames[asUnsigned(mCurrent)];
+    Frame& prevFrame = mFrames[asUnsigned((mCurrent + 2) % 3)];
+    Frame& prevPrevFrame = mFrames[asUnsigned((mCurrent + 1) % 3)];
+    frame.set(transform(in.segment(0, mWindowSize)));
+    auto odf = static_cast<OnsetDetectionFuncs::ODF>(function);
     if (function > 1 && function < 5 && frameDelta != 0)
     {
-      ArrayXcd frame2 =
-          mFFT.process(in.segment(frameDelta, mWindowSize) * mWindow);
-      funcVal = OnsetDetectionFuncs::map()[odf](frame2, frame, frame);
+      mDeltaFrame.set(transform(in.segment(frameDelta, mWindowSize)));
+      funcVal = OnsetDetectionFuncs::process(odf, mDeltaFrame, frame, frame);
     }
     else
     {
       funcVal =
-          OnsetDetectionFuncs::map()[odf](frame, prevFrame, prevPrevFrame);
+          OnsetDetectionFuncs::process(odf, frame, prevFrame, prevPrevFrame);
     }
     if (filterSize >= 3)
       filteredFuncVal = funcVal - mFilter.processSample(funcVal);
     else
       filteredFuncVal = funcVal - mPrevFuncVal;
 
-    prevPrevFrame = prevFrame;
-    prevFrame = frame;
+    mCurrent = (mCurrent + 1) % 3;
 
     if (filteredFuncVal > threshold && mPrevFuncVal < threshold &&
         mDebounceCount == 0)
@@ -102,17 +110,28 @@ public:
 
 private:
   using WindowTypes = WindowFuncs::WindowTypes;
-  FFT          mFFT{1024};
-  ArrayXd      mWindowStorage;
-  ArrayXd      mWindow;
-  index        mWindowSize{1024};
-  index        mDebounceCount{1};
-  ArrayXcd     prevFrame;
-  ArrayXcd     prevPrevFrame;
-  double       mPrevFuncVal{0.0};
-  WindowTypes  mWindowType{WindowTypes::kHann};
-  MedianFilter mFilter;
-  bool         mInitialized{false};
+  using Frame = OnsetDetectionFuncs::Frame;
+
+  template <typename Input>
+  Eigen::Ref<ArrayXcd> transform(const Input& input)
+  {
+    mWindowed.head(mWindowSize) = input * mWindow;
+    return mFFT.process(mWindowed.head(mWindowSize));
+  }
+
+  FFT                  mFFT{1024};
+  ArrayXd              mWindowStorage;
+  ArrayXd              mWindow;
+  ArrayXd              mWindowed;
+  index                mWindowSize{1024};
+  index                mDebounceCount{1};
+  std::array<Frame, 3> mFrames;
+  Frame                mDeltaFrame;
+  index                mCurrent{0};
+  double               mPrevFuncVal{0.0};
+  WindowTypes          mWindowType{WindowTypes::kHann};
+  MedianFilter         mFilter;
+  bool                 mInitialized{false};
 };
 
 } // namespace algorithm
@@ -39,11 +39,11 @@ public:
     using namespace Eigen;
     assert(mixture.cols() == targetMag.cols());
     assert(mixture.rows() == targetMag.rows());
-    ArrayXXcd tmp =
+    // written straight into the result, so no temporary spectrum is made
+    asFluid<Array>(result) =
         asEigen<Array>(mixture) *
         (asEigen<Array>(targetMag).pow(exponent) * mMultiplier.pow(exponent))
             .min(1.0);
-    result = asFluid(tmp);
   }
 
 private:
@@ -33,7 +33,7 @@ class STFT
 public:
   STFT(index windowSize, index fftSize, index hopSize)
       : mWindowSize(windowSize), mHopSize(hopSize), mFrameSize(fftSize / 2 + 1),
-        mFFT(fftSize)
+        mFrame(windowSize), mFFT(fftSize)
   {
     mWindow = ArrayXd::Zero(mWindowSize);
     WindowFuncs::map()[WindowFuncs::WindowTypes::kHann](mWindowSize, mWindow);
@@ -42,15 +42,13 @@ public:
   static void magnitude(const FluidTensorView<std::complex<double>, 2>& in,
                         FluidTensorView<double, 2>                      out)
   {
-    ArrayXXd mag = _impl::asEigen<Eigen::Array>(in).abs().real();
-    out = _impl::asFluid(mag);
+    _impl::asFluid<Eigen::Array>(out) = _impl::asEigen<Eigen::Array>(in).abs();
   }
 
   static void magnitude(const FluidTensorView<std::complex<double>, 1>& in,
                         FluidTensorView<double, 1>                      out)
   {
-    ArrayXd mag = _impl::asEigen<Eigen::Array>(in).abs().real();
-    out = _impl::asFluid(mag);
+    _impl::asFluid<Eigen::Array>(out) = _impl::asEigen<Eigen::Array>(in).abs();
   }
 
 
@@ -76,9 +74,8 @@ public:
   void processFrame(const RealVectorView frame, ComplexVectorView out)
   {
     assert(frame.size() == mWindowSize);
-    ArrayXcd spectrum =
-        mFFT.process(_impl::asEigen<Eigen::Array>(frame) * mWindow);
-    out = _impl::asFluid(spectrum);
+    mFrame = _impl::asEigen<Eigen::Array>(frame) * mWindow;
+    _impl::asFluid<Eigen::Array>(out) = mFFT.process(mFrame);
   }
 
   RealVectorView window()
@@ -91,6 +88,7 @@ private:
   index   mHopSize;
   index   mFrameSize;
   ArrayXd mWindow;
+  ArrayXd mFrame;
   FFT     mFFT;
 };
 
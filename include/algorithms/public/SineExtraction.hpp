@@ -19,8 +19,9 @@ under the European Union’s Horizon 2020 research and innovation programme
 #include "../../data/FluidIndex.hpp"
 #include "../../data/TensorTypes.hpp"
 #include <Eigen/Core>
+#include <algorithm>
 #include <cmath>
-#include <queue>
+#include <vector>
 
 namespace fluid {
 namespace algorithm {
@@ -31,6 +32,7 @@ class SineExtraction
   using ArrayXd = Eigen::ArrayXd;
   using VectorXd = Eigen::VectorXd;
   using ArrayXcd = Eigen::ArrayXcd;
+  using ArrayXXcd = Eigen::ArrayXXcd;
   template <typename T>
   using vector = std::vector<T>;
 
@@ -39,12 +41,16 @@ public:
   {
     mBins = fftSize / 2 + 1;
     mCurrentFrame = 0;
-    mBuf = std::queue<ArrayXcd>();
     mScale = 1.0 / (windowSize / 4.0); // scale to original amplitude
     computeWindowTransform(windowSize, transformSize);
     mTracking.init();
+    mMaxBins = transformSize / 2 + 1;
+    mBuf.resize(mMaxBins,
+                std::max(mBuf.cols(), mTracking.minTrackLength() + 1));
+    clearDelay();
     mWindowBinIncr = mWindowTransform.size() / (mBins - 1) / 2;
     mInvWindowBinIncr = 1.0 / mWindowBinIncr;
+    assert(mWindowBinIncr >= 1);
     mInitialized = true;
   }
 
@@ -56,60 +62,45 @@ public:
   {
     assert(mInitialized);
     using namespace Eigen;
-    index    fftSize = 2 * (mBins - 1);
-    ArrayXcd frame = _impl::asEigen<Array>(in);
+    index fftSize = 2 * (mBins - 1);
     if (minTrackLength != mTracking.minTrackLength())
-    { mBuf = std::queue<ArrayXcd>(); }
-    mBuf.push(frame);
-    ArrayXd mag = frame.abs().real();
-    mag = mag * mScale;
-    ArrayXd          logMag = 20 * mag.max(epsilon).log10();
-    vector<SinePeak> peaks;
-    auto tmpPeaks = mPeakDetection.process(logMag, 0, -infinity, true, false);
-    for (auto p : tmpPeaks)
+      resizeDelay(minTrackLength);
+    pushDelay(in);
+    mMag = _impl::asEigen<Array>(in).abs() * mScale;
+    mLogMag = 20 * mMag.max(epsilon).log10();
+    mPeaks.clear();
+    mPeakDetection.process(mLogMag, mPeakPairs, 0, -infinity, true, false);
+    for (auto& p : mPeakPairs)
     {
       if (p.second > detectionThreshold)
       {
         double hz = sampleRate * p.first / fftSize;
-        peaks.push_back({hz, p.second, false});
+        mPeaks.push_back({hz, p.second, false});
       }
     }
-    double maxAmp = 20 * std::log10(mag.maxCoeff());
-    mTracking.processFrame(peaks, maxAmp, minTrackLength, birthLowThreshold,
+    double maxAmp = 20 * std::log10(mMag.maxCoeff());
+    mTracking.processFrame(mPeaks, maxAmp, minTrackLength, birthLowThreshold,
                            birthHighThreshold, trackMethod, zetaA, zetaF,
                            delta);
-    vector<SinePeak> sinePeaks = mTracking.getActivePeaks();
-    ArrayXd          frameSines = ArrayXd::Zero(mBins);
-    for (auto& p : sinePeaks)
-    { frameSines += synthesizePeak(p, sampleRate, bandwidth); }
-    ArrayXXcd result(mBins, 2);
-    if (asSigned(mBuf.size()) <= mTracking.minTrackLength())
-    {
-      result.col(0) = ArrayXd::Zero(mBins);
-      result.col(1) = ArrayXd::Zero(mBins);
-    }
+    const vector<SinePeak>& sinePeaks = mTracking.getActivePeaks();
+    ArrayXd& frameSines = mFrameSines;
+    frameSines.setZero(mBins);
+    for (auto& p : sinePeaks) addPeak(p, sampleRate, bandwidth, frameSines);
+    auto result = _impl::asFluid<Array>(out);
+    if (mBufCount <= mTracking.minTrackLength())
+      result.setZero();
     else
     {
-      ArrayXcd resultFrame = mBuf.front();
-      ArrayXd  resultMag = resultFrame.abs().real();
-      for (index i = 0; i < mBins; i++)
-      {
-        if (frameSines(i) >= resultMag(i))
-        {
-          result(i, 0) = resultFrame(i);
-          result(i, 1) = 0;
-        }
-        else
-        {
-          double sineWeight = frameSines(i) / resultMag(i);
-          result(i, 0) = resultFrame(i) * sineWeight;
-          result(i, 1) = resultFrame(i) * (1 - sineWeight);
-        }
-      }
-      mBuf.pop();
+      // each delayed bin goes to the sines in proportion to the synthesised
+      // magnitude, up to all of it
+      auto delayed = mBuf.col(mBufHead).head(mBins);
+      mMag = delayed.abs();
+      mSineWeight = (frameSines >= mMag).select(1.0, frameSines / mMag);
+      result.col(0) = delayed * mSineWeight;
+      result.col(1) = delayed * (1 - mSineWeight);
+      popDelay();
     }
     mTracking.prune();
-    out = _impl::asFluid(result);
     mCurrentFrame++;
   }
 
@@ -119,6 +110,35 @@ public:
   bool initialized() { return mInitialized; }
 
 private:
+  // Input spectra wait in a ring of columns for the tracker's latency. The
+  // ring holds at least one frame more than minTrackLength, and is only
+  // reallocated when that grows beyond its capacity.
+  void resizeDelay(index minTrackLength)
+  {
+    if (minTrackLength + 1 > mBuf.cols())
+      mBuf.resize(mMaxBins, minTrackLength + 1);
+    clearDelay();
+  }
+
+  void clearDelay()
+  {
+    mBufHead = 0;
+    mBufCount = 0;
+  }
+
+  void pushDelay(const ComplexVectorView in)
+  {
+    assert(mBufCount < mBuf.cols());
+    index slot = (mBufHead + mBufCount++) % mBuf.cols();
+    mBuf.col(slot).head(mBins) = _impl::asEigen<Eigen::Array>(in);
+  }
+
+  void popDelay()
+  {
+    mBufHead = (mBufHead + 1) % mBuf.cols();
+    mBufCount--;
+  }
+
   void computeWindowTransform(index windowSize, index transformSize)
   {
     index halfBW = transformSize / 2;
@@ -133,52 +153,94 @@ private:
       mWindowTransform(halfBW + i) = mWindowTransform(halfBW - i) =
           std::abs(transform(i));
     }
+    mWindowSlope = ArrayXd::Zero(transformSize);
+    mWindowSlope.head(transformSize - 1) =
+        mWindowTransform.tail(transformSize - 1) -
+        mWindowTransform.head(transformSize - 1);
   }
 
-  double interpolateWindow(double pos)
-  {
-    index  floor = std::lrint(std::floor(pos));
-    double frac = pos - floor;
-    double dY = mWindowTransform(floor + 1) - mWindowTransform(floor);
-    return mWindowTransform(floor) + frac * mInvWindowBinIncr * dY;
-  }
-
-  ArrayXd synthesizePeak(SinePeak p, double sampleRate, index bandwidth)
+  // Adds the spectrum of a peak to frame, over the bins within bandwidth.
+  // Bins are a whole number of table points apart, so every bin on one side
+  // of the peak interpolates the table at the same fraction, and each side
+  // is one strided pass over the table and its differences.
+  void addPeak(const SinePeak& p, double sampleRate, index bandwidth,
+               ArrayXd& frame)
   {
     using namespace std;
-    index   halfBW = bandwidth / 2;
-    ArrayXd sine = ArrayXd::Zero(mBins);
-    double  freqBin = p.freq * 2 * (mBins - 1) / sampleRate;
+    using Taps = Eigen::Map<const ArrayXd, 0, Eigen::InnerStride<>>;
+    index  halfBW = bandwidth / 2;
+    index  tableSize = mWindowTransform.size();
+    index  stride = static_cast<index>(mWindowBinIncr);
+    double freqBin = p.freq * 2 * (mBins - 1) / sampleRate;
     if (freqBin >= mBins - 1) freqBin = mBins - 1;
     if (freqBin < 0) freqBin = 0;
     index  freqBinFloor = lrint(floor(freqBin));
     index  freqBinCeil = freqBinFloor + 1;
     double amp = 0.5 * pow(10, p.logMag / 20);
+
+    // upwards from the bin above the peak, while pos < tableSize - 2
     double pos = mWindowTransform.size() / 2 +
                  ((freqBinCeil - freqBin) * mWindowBinIncr);
-    for (index i = freqBinCeil; pos < mWindowTransform.size() - 2 &&
-                                i < min(freqBinCeil + halfBW, mBins - 1);
-         i++, pos += mWindowBinIncr)
-    { sine[i] = amp * interpolateWindow(pos); }
+    index  n = min(freqBinCeil + halfBW, mBins - 1) - freqBinCeil;
+    n = min(max(n, index(0)), countBelow(pos, tableSize - 2, stride));
+    if (n > 0)
+    {
+      index  first = lrint(floor(pos));
+      double weight = (pos - first) * mInvWindowBinIncr;
+      Taps   window(mWindowTransform.data() + first, n,
+                    Eigen::InnerStride<>(stride));
+      Taps   slope(mWindowSlope.data() + first, n,
+                   Eigen::InnerStride<>(stride));
+      frame.segment(freqBinCeil, n) += amp * (window + weight * slope);
+    }
+
+    // downwards from the bin below the peak, while pos > 1
     pos = (mWindowTransform.size() / 2) -
           ((freqBin - freqBinFloor) * mWindowBinIncr);
-    for (index i = freqBinFloor;
-         pos > 1 && i > max(freqBinFloor - halfBW, asSigned(0));
-         i--, pos -= mWindowBinIncr)
-    { sine[i] = amp * interpolateWindow(pos); }
-    return sine;
+    n = max(freqBinFloor - max(freqBinFloor - halfBW, asSigned(0)), index(0));
+    n = min(n, countBelow(-pos, -1, stride));
+    if (n > 0)
+    {
+      index  first = lrint(floor(pos)) - (n - 1) * stride;
+      double weight = (pos - floor(pos)) * mInvWindowBinIncr;
+      Taps   window(mWindowTransform.data() + first, n,
+                    Eigen::InnerStride<>(stride));
+      Taps   slope(mWindowSlope.data() + first, n,
+                   Eigen::InnerStride<>(stride));
+      frame.segment(freqBinFloor - n + 1, n) += amp * (window + weight * slope);
+    }
+  }
+
+  // number of k >= 0 for which pos + k * stride < limit
+  static index countBelow(double pos, double limit, index stride)
+  {
+    if (!(pos < limit)) return 0;
+    index n = static_cast<index>(std::ceil((limit - pos) / stride));
+    while (n > 1 && !(pos + (n - 1) * stride < limit)) n--;
+    while (pos + n * stride < limit) n++;
+    return n;
   }
 
-  PeakDetection        mPeakDetection;
-  PartialTracking      mTracking;
-  index                mBins{513};
-  index                mCurrentFrame{0};
-  std::queue<ArrayXcd> mBuf;
-  ArrayXd              mWindowTransform;
-  double               mScale{1.0};
-  bool                 mInitialized{false};
-  double               mWindowBinIncr;
-  double               mInvWindowBinIncr;
+  PeakDetection                          mPeakDetection;
+  PartialTracking                        mTracking;
+  vector<SinePeak>                       mPeaks;
+  vector<std::pair<double, double>>      mPeakPairs;
+  index                                  mBins{513};
+  index                                  mMaxBins{513};
+  index                                  mCurrentFrame{0};
+  ArrayXXcd                              mBuf;
+  index                                  mBufHead{0};
+  index                                  mBufCount{0};
+  ArrayXd                                mWindowTransform;
+  ArrayXd                                mWindowSlope; // table differences
+  ArrayXd                                mFrameSines;
+  ArrayXd                                mMag;
+  ArrayXd                                mLogMag;
+  ArrayXd                                mSineWeight;
+  double                                 mScale{1.0};
+  bool                                   mInitialized{false};
+  double                                 mWindowBinIncr;
+  double                                 mInvWindowBinIncr;
 };
 } // namespace algorithm
 } // namespace fluid
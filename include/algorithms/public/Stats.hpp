@@ -13,74 +13,333 @@ under the European Union’s Horizon 2020 research and innovation programme
 #include "../../data/TensorTypes.hpp"
 #include "../../data/FluidIndex.hpp"
 #include <Eigen/Core>
+#include <algorithm>
+#include <array>
 #include <cassert>
 #include <cmath>
+#include <limits>
+#include <vector>
 
 namespace fluid {
 namespace algorithm {
 
+/**
+ Mean, standard deviation, skewness, kurtosis and three percentiles of a
+ series, and optionally of its first and second differences.
+
+ Values can be given all at once to process(), or streamed through begin(),
+ add() and finish(). They are taken a chunk at a time: the moments of each
+ chunk are merged into running totals, and the percentiles come either from
+ selection over the stored values or, in approximate mode, from a histogram of
+ fixed size (see Histogram).
+ **/
 class Stats
 {
+  static constexpr index kChunkSize = 4096;
+
 public:
-  void init(index numDerivatives, double low, double mid, double high)
+  void init(index numDerivatives, double low, double mid, double high,
+            bool approximate = false)
   {
     assert(numDerivatives <= 2);
     mNumDerivatives = numDerivatives;
     mLow = low / 100.0;
     mMiddle = mid / 100.0;
     mHigh = high / 100.0;
+    mApproximate = approximate;
   }
   index numStats() { return 7; }
 
   Eigen::ArrayXd computeStats(Eigen::Ref<Eigen::ArrayXd> input)
   {
-    using namespace Eigen;
-    using namespace std;
-    index   length = input.size();
-    ArrayXd out = ArrayXd::Zero(7);
-    double  mean = input.mean();
-    double  stdev = sqrt((input - mean).square().mean());
-    double  skewness = ((input - mean) / (stdev == 0 ? 1 : stdev)).cube().mean();
-    double  kurtosis = ((input - mean) / (stdev == 0 ? 1 : stdev)).pow(4).mean();
-    ArrayXd sorted = input;
-    sort(sorted.data(), sorted.data() + length);
-    double low = sorted(lrint(mLow * (length - 1)));
-    double mid = sorted(lrint(mMiddle * (length - 1)));
-    double high = sorted(lrint(mHigh * (length - 1)));
-    out << mean, stdev, skewness, kurtosis, low, mid, high;
+    Series series;
+    series.reset(mApproximate, input.size());
+    mScratch.resize(kChunkSize + 2);
+    for (index start = 0; start < input.size(); start += kChunkSize)
+    {
+      index size = std::min(input.size() - start, index(kChunkSize));
+      series.add(input.segment(start, size), mScratch);
+    }
+    Eigen::ArrayXd out(numStats());
+    series.result(mLow, mMiddle, mHigh, out);
     return out;
   }
 
   void process(const RealVectorView in, RealVectorView out)
   {
-    using namespace Eigen;
-    using namespace _impl;
-    using fluid::Slice;
+    begin(in.size());
+    add(in);
+    finish(out);
+  }
+
+  // starts a new series, of about sizeHint values if known
+  void begin(index sizeHint = 0)
+  {
+    for (index i = 0; i <= mNumDerivatives; i++)
+      mSeries[asUnsigned(i)].reset(mApproximate, sizeHint - i);
+    mChunk.setZero(kChunkSize + 2);
+    mDiff.resize(kChunkSize + 1);
+    mDiff2.resize(kChunkSize);
+    mScratch.resize(kChunkSize + 2);
+    mResult.resize(numStats());
+    mCount = 0;
+  }
+
+  // adds the next values of the series
+  template <typename T>
+  void add(const FluidTensorView<T, 1> in)
+  {
+    assert(mChunk.size() == kChunkSize + 2 && "Stats: add() before begin()");
+    for (index start = 0; start < in.size(); start += kChunkSize)
+    {
+      index size = std::min(in.size() - start, index(kChunkSize));
+      // the chunk is preceded by the last two values of the previous one, so
+      // that differences continue across chunks
+      for (index i = 0; i < size; i++)
+        mChunk(i + 2) = static_cast<double>(in(start + i));
+      addChunk(size);
+    }
+  }
+
+  void finish(RealVectorView out)
+  {
     assert(out.size() == numStats() * (mNumDerivatives + 1));
-    ArrayXd input = asEigen<Array>(in);
-    index   length = input.size();
-    ArrayXd raw = computeStats(input);
-    out(Slice(0, numStats())) = asFluid(raw);
+    for (index i = 0; i <= mNumDerivatives; i++)
+    {
+      mSeries[asUnsigned(i)].result(mLow, mMiddle, mHigh, mResult);
+      out(Slice(i * numStats(), numStats())) = _impl::asFluid(mResult);
+    }
+  }
+
+  /**
+   Counts of values in kBins equal bins centred on the first value. When a
+   value falls outside, the bin width doubles by merging neighbouring pairs, so
+   the width ends up at most 4 / kBins of the range of the data. Percentiles
+   interpolate within their bin, and are within a bin width of the exact
+   value.
+   **/
+  class Histogram
+  {
+  public:
+    static constexpr index kBins = 4096;
+
+    void reset()
+    {
+      mCounts.setZero(kBins);
+      mScratch.resize(kBins);
+      mWidth = 0;
+      mTotal = 0;
+    }
+
+    template <typename Derived>
+    void add(const Eigen::ArrayBase<Derived>& x)
+    {
+      if (x.size() == 0) return;
+      if (mTotal == 0) mCentre = x(0);
+      double min = x.minCoeff(), max = x.maxCoeff();
+      if (mWidth == 0 && min == mCentre && max == mCentre)
+      {
+        // no spread yet: everything is in the bin starting at the centre
+        mCounts(kBins / 2) += x.size();
+        mTotal += x.size();
+        return;
+      }
+      if (mWidth == 0)
+        mWidth = 2 * std::max(max - mCentre, mCentre - min) / kBins;
+      while (bin(min) < 0 || bin(max) >= kBins) grow();
+      for (index i = 0; i < x.size(); i++) mCounts(bin(x(i)))++;
+      mTotal += x.size();
+    }
+
+    // value of the given rank (0 is the smallest), clipped to [min, max]
+    double quantile(index rank, double min, double max) const
+    {
+      index below = 0;
+      index i = 0;
+      while (below + mCounts(i) <= rank) below += mCounts(i++);
+      double offset =
+          (static_cast<double>(rank - below) + 0.5) / mCounts(i);
+      double value = mCentre + (i - kBins / 2 + offset) * mWidth;
+      return std::min(std::max(value, min), max);
+    }
+
+  private:
+    index bin(double x) const
+    {
+      return static_cast<index>(std::floor((x - mCentre) / mWidth)) +
+             kBins / 2;
+    }
+
+    void grow()
+    {
+      mScratch.setZero();
+      for (index i = 0; i < kBins; i++)
+        mScratch((i + kBins / 2) / 2) += mCounts(i);
+      std::swap(mCounts, mScratch);
+      mWidth *= 2;
+    }
+
+    using ArrayXi = Eigen::Array<index, Eigen::Dynamic, 1>;
+
+    ArrayXi mCounts;
+    ArrayXi mScratch;
+    double  mCentre{0};
+    double  mWidth{0};
+    index   mTotal{0};
+  };
+
+private:
+  // running count, mean, central moments, extremes and percentile data of one
+  // series; moments of each chunk are merged into the totals as in Pébay,
+  // "Formulas for robust, one-pass parallel computation of covariances and
+  // arbitrary-order statistical moments" (2008)
+  class Series
+  {
+  public:
+    void reset(bool approximate, index sizeHint)
+    {
+      mApproximate = approximate;
+      mCount = 0;
+      mMean = mM2 = mM3 = mM4 = 0;
+      mMin = std::numeric_limits<double>::infinity();
+      mMax = -std::numeric_limits<double>::infinity();
+      mValues.clear();
+      if (approximate)
+        mHistogram.reset();
+      else
+        mValues.reserve(asUnsigned(std::max<index>(sizeHint, 0)));
+    }
+
+    // scratch needs room for x
+    template <typename Derived>
+    void add(const Eigen::ArrayBase<Derived>& x, Eigen::ArrayXd& scratch)
+    {
+      if (x.size() == 0) return;
+      double n = static_cast<double>(x.size());
+      double mean = x.mean();
+      auto   centred = scratch.head(x.size());
+      centred = x - mean;
+      double m2 = centred.square().sum();
+      double m3 = (centred.square() * centred).sum();
+      double m4 = centred.square().square().sum();
+      merge(n, mean, m2, m3, m4);
+      mMin = std::min(mMin, x.minCoeff());
+      mMax = std::max(mMax, x.maxCoeff());
+      if (mApproximate)
+        mHistogram.add(x);
+      else
+        mValues.insert(mValues.end(), x.derived().data(),
+                       x.derived().data() + x.size());
+    }
+
+    // mean, standard deviation, skewness, kurtosis, low, middle, high
+    template <typename Out>
+    void result(double low, double middle, double high, Out&& out)
+    {
+      using namespace std;
+      if (mCount == 0)
+      {
+        out.setZero();
+        return;
+      }
+      double n = static_cast<double>(mCount);
+      double stdev = sqrt(mM2 / n);
+      double scale = stdev == 0 ? 1 : stdev;
+      out(0) = mMean;
+      out(1) = stdev;
+      out(2) = mM3 / n / (scale * scale * scale);
+      out(3) = mM4 / n / (scale * scale * scale * scale);
+      std::array<index, 3> ranks{{lrint(low * (mCount - 1)),
+                                  lrint(middle * (mCount - 1)),
+                                  lrint(high * (mCount - 1))}};
+      if (mApproximate)
+      {
+        for (index i = 0; i < 3; i++)
+          out(4 + i) = mHistogram.quantile(ranks[asUnsigned(i)], mMin, mMax);
+        return;
+      }
+      // select the middle rank first, then the others on either side of it
+      auto begin = mValues.begin();
+      auto mid = begin + ranks[1];
+      std::nth_element(begin, mid, mValues.end());
+      if (ranks[0] < ranks[1]) std::nth_element(begin, begin + ranks[0], mid);
+      if (ranks[2] > ranks[1])
+        std::nth_element(mid + 1, begin + ranks[2], mValues.end());
+      for (index i = 0; i < 3; i++)
+        out(4 + i) = mValues[asUnsigned(ranks[asUnsigned(i)])];
+    }
+
+  private:
+    void merge(double nB, double meanB, double m2B, double m3B, double m4B)
+    {
+      double nA = static_cast<double>(mCount);
+      double n = nA + nB;
+      double delta = meanB - mMean;
+      double delta2 = delta * delta;
+      double m2 = mM2 + m2B + delta2 * nA * nB / n;
+      double m3 = mM3 + m3B + delta2 * delta * nA * nB * (nA - nB) / (n * n) +
+                  3 * delta * (nA * m2B - nB * mM2) / n;
+      double m4 = mM4 + m4B +
+                  delta2 * delta2 * nA * nB * (nA * nA - nA * nB + nB * nB) /
+                      (n * n * n) +
+                  6 * delta2 * (nA * nA * m2B + nB * nB * mM2) / (n * n) +
+                  4 * delta * (nA * m3B - nB * mM3) / n;
+      mMean += delta * nB / n;
+      mM2 = m2;
+      mM3 = m3;
+      mM4 = m4;
+      mCount += static_cast<index>(nB);
+    }
+
+    bool                mApproximate{false};
+    index               mCount{0};
+    double              mMean{0};
+    double              mM2{0};
+    double              mM3{0};
+    double              mM4{0};
+    double              mMin{0};
+    double              mMax{0};
+    std::vector<double> mValues;
+    Histogram           mHistogram;
+  };
+
+  // values are in mChunk from position 2; positions 0 and 1 hold the last two
+  // values before them, once there are any
+  void addChunk(index size)
+  {
+    mSeries[0].add(mChunk.segment(2, size), mScratch);
     if (mNumDerivatives > 0)
     {
-      ArrayXd diff1 =
-          input.segment(1, length - 1) - input.segment(0, length - 1);
-      ArrayXd d1 = computeStats(diff1);
-      out(Slice(numStats(), numStats())) = asFluid(d1);
-      if (mNumDerivatives > 1)
+      index skip1 = std::max<index>(1 - mCount, 0);
+      index skip2 = std::max<index>(2 - mCount, 0);
+      // diff(i) is the first difference ending at chunk position i + 1
+      mDiff.head(size + 1) =
+          mChunk.segment(1, size + 1) - mChunk.segment(0, size + 1);
+      if (skip1 < size)
+        mSeries[1].add(mDiff.segment(1 + skip1, size - skip1), mScratch);
+      if (mNumDerivatives > 1 && skip2 < size)
       {
-        ArrayXd diff2 =
-            diff1.segment(1, length - 2) - diff1.segment(0, length - 2);
-        ArrayXd d2 = computeStats(diff2);
-        out(Slice(2 * numStats(), numStats())) = asFluid(d2);
+        mDiff2.head(size - skip2) = mDiff.segment(1 + skip2, size - skip2) -
+                                    mDiff.segment(skip2, size - skip2);
+        mSeries[2].add(mDiff2.head(size - skip2), mScratch);
       }
     }
+    mChunk.head(2) = mChunk.segment(size, 2);
+    mCount += size;
   }
 
-  index  mNumDerivatives{0};
-  double mLow{0};
-  double mMiddle{0.5};
-  double mHigh{1};
+  index                 mNumDerivatives{0};
+  double                mLow{0};
+  double                mMiddle{0.5};
+  double                mHigh{1};
+  bool                  mApproximate{false};
+  index                 mCount{0};
+  std::array<Series, 3> mSeries;
+  Eigen::ArrayXd        mChunk;
+  Eigen::ArrayXd        mDiff;
+  Eigen::ArrayXd        mDiff2;
+  Eigen::ArrayXd        mScratch;
+  Eigen::ArrayXd        mResult;
 };
 } // namespace algorithm
 } // namespace fluid
@@ -15,6 +15,7 @@ under the European Union’s Horizon 2020 research and innovation programme
 #include "../../data/TensorTypes.hpp"
 #include <Eigen/Core>
 #include <algorithm>
+#include <cassert>
 #include <cmath>
 #include <random>
 #include <vector>
@@ -28,6 +29,8 @@ class TransientExtraction
   using ARModel = algorithm::ARModel;
   using MatrixXd = Eigen::MatrixXd;
   using VectorXd = Eigen::VectorXd;
+  using RowMatrixXd =
+      Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>;
 
 public:
 
@@ -45,14 +48,20 @@ public:
     mDetectPowerFactor = power;
     mDetectThreshHi = threshHi;
     mDetectThreshLo = threshLo;
-    mDetectHalfWindow = halfWindow;
     mDetectHold = hold;
+    if (halfWindow != mDetectHalfWindow)
+    {
+      mDetectHalfWindow = halfWindow;
+      calcWindowTaps();
+      if (mBlockSize) resizeStorage();
+    }
   }
 
   void prepareStream(index blockSize, index padSize)
   {
     mBlockSize = std::max(blockSize, modelOrder());
     mPadSize = std::max(padSize, modelOrder());
+    calcWindowTaps();
     resizeStorage();
   }
 
@@ -142,13 +151,11 @@ private:
     // Forward and backward error
     const double normFactor = 1.0 / sqrt(mModel.variance());
     errorCalculation<&ARModel::forwardErrorArray>(
-        mForwardError.data(), input, blockSize() + mDetectHalfWindow + 1,
-        normFactor);
+        mForwardError.data(), input, errorSize(), normFactor);
     errorCalculation<&ARModel::backwardErrorArray>(
-        mBackwardError.data(), input, blockSize() + mDetectHalfWindow + 1,
-        normFactor);
+        mBackwardError.data(), input, errorSize(), normFactor);
 
-    // Window error functions (brute force convolution)
+    // Window error functions
     windowError(mForwardWindowedError.data(),
                 mForwardError.data() + modelOrder(), hopSize());
     windowError(mBackwardWindowedError.data(),
@@ -232,6 +239,10 @@ private:
     return Method(view);
   }
 
+  // Least squares AR interpolation of the detected samples: minimise the
+  // prediction error over the block given the known samples. The normal
+  // equations only couple unknowns less than order samples apart, so they are
+  // banded, and are solved by banded Cholesky in O(nUnknowns * order^2).
   void interpolate(double* transients, double* residual)
   {
     const double* input = mInput.data() + padSize() + modelOrder();
@@ -246,48 +257,85 @@ private:
       return;
     }
 
-    // Declare matrices
-    MatrixXd A = MatrixXd::Zero(size - order, size);
-    MatrixXd U = MatrixXd::Zero(size, mCount);
-    MatrixXd K = MatrixXd::Zero(size, size - mCount);
-    VectorXd xK(size - mCount);
+    // prediction error filter, b[k] weighting input[i + k] in error i
+    for (index k = 0; k < order; k++)
+      mFilter[asUnsigned(k)] = -parameters[order - (k + 1)];
+    mFilter[asUnsigned(order)] = 1.0;
+    const double* b = mFilter.data();
+
+    // unknown sample positions, and the input with them zeroed
+    index nUnknown = 0;
+    std::copy(input, input + size, mKnown.data());
+    for (index i = order; i < size; i++)
+    {
+      if (mDetect[asUnsigned(i - order)] != 0)
+      {
+        mUnknowns[asUnsigned(nUnknown++)] = i;
+        mKnown[asUnsigned(i)] = 0.0;
+      }
+    }
+    assert(nUnknown == mCount);
+    const index* u = mUnknowns.data();
 
-    // Form data
+    // prediction errors of the known samples alone
     for (index i = 0; i < size - order; i++)
     {
-      for (index j = 0; j < order; j++)
-        A(i, j + i) = -parameters[order - (j + 1)];
+      double error = 0.0;
+      for (index k = 0; k <= order; k++)
+        error += b[k] * mKnown[asUnsigned(i + k)];
+      mError[asUnsigned(i)] = error;
+    }
 
-      A(i, order + i) = 1.0;
+    // right hand side, -Au' * error
+    for (index p = 0; p < nUnknown; p++)
+    {
+      double sum = 0.0;
+      for (index i = u[p] - order; i <= std::min(u[p], size - order - 1); i++)
+        sum += b[u[p] - i] * mError[asUnsigned(i)];
+      mSolution(p) = -sum;
     }
 
-    for (index i = 0, uCount = 0, kCount = 0; i < size; i++)
+    // banded Cholesky of Au' * Au, L(p, p - d) stored at mBand(p, d)
+    for (index p = 0; p < nUnknown; p++)
     {
-      if (i >= order && mDetect[asUnsigned(i - order)] != 0)
-        U(i, uCount++) = 1.0;
-      else
+      for (index d = std::min(p, order); d >= 0; d--)
       {
-        K(i, kCount) = 1.0;
-        xK[kCount++] = input[i];
+        index  q = p - d;
+        double sum = 0.0;
+        // (Au' * Au)(p, q): rows where both columns of Au are non-zero
+        if (u[p] - u[q] <= order)
+          for (index i = u[p] - order; i <= std::min(u[q], size - order - 1);
+               i++)
+            sum += b[u[p] - i] * b[u[q] - i];
+        for (index k = std::max<index>(p - order, 0); k < q; k++)
+          sum -= mBand(p, p - k) * mBand(q, q - k);
+        mBand(p, d) = d ? sum / mBand(q, 0) : std::sqrt(sum);
       }
     }
 
-    // Solve
-    MatrixXd Au = A * U;
-    MatrixXd M = -(Au.transpose() * Au);
-    MatrixXd u = M.fullPivLu().solve(Au.transpose() * (A * K) * xK);
+    // forward then back substitution
+    for (index p = 0; p < nUnknown; p++)
+    {
+      for (index k = std::max<index>(p - order, 0); k < p; k++)
+        mSolution(p) -= mBand(p, p - k) * mSolution(k);
+      mSolution(p) /= mBand(p, 0);
+    }
+    for (index p = nUnknown - 1; p >= 0; p--)
+    {
+      for (index k = p + 1; k <= std::min(p + order, nUnknown - 1); k++)
+        mSolution(p) -= mBand(k, k - p) * mSolution(k);
+      mSolution(p) /= mBand(p, 0);
+    }
 
     // Write the output
     for (index i = 0, uCount = 0; i < (size - order); i++)
     {
       if (mDetect[asUnsigned(i)] != 0)
-        residual[i] = u(uCount++);
+        residual[i] = mSolution(uCount++);
       else
         residual[i] = input[i + order];
     }
 
-    if (mRefine) refine(residual, size, Au, u);
-
     for (index i = 0; i < (size - order); i++)
       transients[i] = input[i + order] - residual[i];
 
@@ -296,40 +344,6 @@ private:
               mInput.data() + padSize() + order + order);
   }
 
-  void refine(double* io, index size, Eigen::MatrixXd& Au, Eigen::MatrixXd& ls)
-  {
-    const double energy = mModel.variance() * mCount;
-    double       energyLS = 0.0;
-    index        order = modelOrder();
-
-    for (index i = 0; i < (size - order); i++)
-    {
-      if (mDetect[asUnsigned(i)] != 0)
-      {
-        const double error = mModel.forwardError(io + i);
-        energyLS += error * error;
-      }
-    }
-
-    if (energyLS < energy)
-    {
-      // Create the square matrix and solve
-      Eigen::LLT<Eigen::MatrixXd> M(Au.transpose() *
-                                    Au); // Cholesky decomposition
-
-      Eigen::VectorXd u(mCount);
-
-      Eigen::MatrixXd correction = M.solve(u) + ls;
-
-      // Write the output
-      for (index i = 0, uCount = 0; i < (size - order); i++)
-      {
-        if (mDetect[asUnsigned(i)] != 0) io[asUnsigned(i)] = u(uCount++);
-      }
-
-    }
-  }
-
   double randomSampling(Eigen::VectorXd& output, double variance)
   {
     std::normal_distribution<double> gaussian(0.0, sqrt(variance));
@@ -358,44 +372,71 @@ private:
   // Triangle window
   double calcWindow(double norm) { return std::min(norm, 1.0 - norm); }
 
-  void windowError(double* errorWindowed, const double* error, index size)
+  // The first tap of the window is always zero, so only the rest are kept
+  void calcWindowTaps()
   {
-    const index  windowSize = mDetectHalfWindow * 2 + 1;
-    const index  windowOffset = mDetectHalfWindow;
-    const double powFactor = mDetectPowerFactor;
+    const index windowSize = mDetectHalfWindow * 2 + 1;
+
+    mWindowTaps.resize(windowSize - 1);
 
-    // Calculate window normalisation factor
-    double windowNormFactor = 0.0;
+    double windowSum = 0.0;
 
     for (index j = 0; j < windowSize; j++)
-      windowNormFactor += calcWindow((double) j / windowSize);
+      windowSum += calcWindow((double) j / windowSize);
 
-    windowNormFactor = 1.0 / windowNormFactor;
+    for (index j = 1; j < windowSize; j++)
+      mWindowTaps(j - 1) = calcWindow((double) j / windowSize);
 
-    // Do window processing
-    for (index i = 0; i < size; i++)
-    {
-      double windowed = 0.0;
+    mWindowNormFactor = 1.0 / windowSum;
+  }
 
-      for (index j = 1; j < windowSize; j++)
-      {
-        const double value = pow(fabs(error[i - windowOffset + j]), powFactor);
-        windowed += value * calcWindow((double) j / windowSize);
-        ;
-      }
+  void windowError(double* errorWindowed, const double* error, index size)
+  {
+    const index  nTaps = mWindowTaps.size();
+    const double powFactor = mDetectPowerFactor;
+
+    // raise each error to the power once, rather than once per tap
+    auto errors = Eigen::Map<const Eigen::ArrayXd>(
+        error - mDetectHalfWindow + 1, size + nTaps - 1);
+    auto powered = mPoweredError.head(size + nTaps - 1);
+
+    if (powFactor == 1.0)
+      powered = errors.abs().matrix();
+    else
+      powered = errors.abs().pow(powFactor).matrix();
 
-      errorWindowed[i] = pow((windowed * windowNormFactor), 1.0 / powFactor);
+    for (index i = 0; i < size; i++)
+    {
+      const double windowed = powered.segment(i, nTaps).dot(mWindowTaps);
+      errorWindowed[i] = pow((windowed * mWindowNormFactor), 1.0 / powFactor);
     }
   }
 
+  // errors are needed up to halfWindow past the block for the detection window
+  index errorSize() const { return mBlockSize + mDetectHalfWindow + 1; }
+
   void resizeStorage()
   {
-    mInput.resize(asUnsigned(analysisSize() + modelOrder()), 0.0);
+    // the backward error reads order samples past the last error, so short
+    // padding needs a zero tail to keep it inside the input
+    const index inputSize = analysisSize() + modelOrder();
+    const index tailSize = std::max<index>(
+        0, errorSize() + modelOrder() - mBlockSize - padSize());
+    mInput.resize(asUnsigned(inputSize + tailSize), 0.0);
+    std::fill(mInput.begin() + inputSize, mInput.end(), 0.0);
     mDetect.resize(asUnsigned(hopSize()), 0.0);
-    mForwardError.resize(asUnsigned(mBlockSize + modelOrder()), 0.0);
-    mBackwardError.resize(asUnsigned(mBlockSize + modelOrder()), 0.0);
+    const index errorStorage = std::max(mBlockSize + modelOrder(), errorSize());
+    mForwardError.resize(asUnsigned(errorStorage), 0.0);
+    mBackwardError.resize(asUnsigned(errorStorage), 0.0);
+    mPoweredError.resize(hopSize() + mWindowTaps.size());
     mForwardWindowedError.resize(asUnsigned(hopSize()), 0.0);
     mBackwardWindowedError.resize(asUnsigned(hopSize()), 0.0);
+    mFilter.resize(asUnsigned(modelOrder() + 1));
+    mKnown.resize(asUnsigned(mBlockSize));
+    mError.resize(asUnsigned(hopSize()));
+    mUnknowns.resize(asUnsigned(hopSize()));
+    mBand.resize(hopSize(), modelOrder() + 1);
+    mSolution.resize(hopSize());
   }
 
   ARModel mModel{20};
@@ -405,12 +446,12 @@ private:
   index  mBlockSize{0};
   index  mPadSize{0};
   index  mCount{0};
-  bool   mRefine{false};
   index  mDetectHalfWindow{1};
   index  mDetectHold{25};
   double mDetectPowerFactor{1.4};
   double mDetectThreshHi{1.5};
   double mDetectThreshLo{3.0};
+  double mWindowNormFactor{1.0};
 
   std::vector<double> mInput;
   std::vector<double> mDetect;
@@ -418,6 +459,14 @@ private:
   std::vector<double> mBackwardError;
   std::vector<double> mForwardWindowedError;
   std::vector<double> mBackwardWindowedError;
+  std::vector<double> mFilter;
+  std::vector<double> mKnown;
+  std::vector<double> mError;
+  std::vector<index>  mUnknowns;
+  RowMatrixXd         mBand;
+  VectorXd            mSolution;
+  VectorXd            mWindowTaps;
+  VectorXd            mPoweredError;
   bool                mInitialized{false};
 };
 
@@ -10,13 +10,14 @@ under the European Union’s Horizon 2020 research and innovation programme
 #pragma once
 
 #include "ConvolutionTools.hpp"
-#include "Toeplitz.hpp"
 #include "../public/WindowFuncs.hpp"
 #include "../../data/FluidIndex.hpp"
 #include <Eigen/Eigen>
 #include <algorithm>
 #include <cmath>
 #include <functional>
+#include <memory>
+#include <vector>
 
 namespace fluid {
 namespace algorithm {
@@ -24,13 +25,13 @@ namespace algorithm {
 class ARModel
 {
 
-  using MatrixXd = Eigen::MatrixXd;
   using ArrayXd = Eigen::ArrayXd;
   using VectorXd = Eigen::VectorXd;
 
 public:
   ARModel(index order)
-      : mParameters(VectorXd::Zero(order))
+      : mParameters(VectorXd::Zero(order)),
+        mAutocorrelation(VectorXd::Zero(order + 1))
   {}
 
   const double* getParameters() const { return mParameters.data(); }
@@ -109,7 +110,7 @@ private:
   void directEstimate(const double* input, index size, bool updateVariance)
   {
     // copy input to a 32 byte aligned block (otherwise risk segfaults on Linux)
-    VectorXd frame = Eigen::Map<const VectorXd>(input, size);
+    mFrame = Eigen::Map<const VectorXd>(input, size);
 
     if (mUseWindow)
     {
@@ -119,59 +120,123 @@ private:
         WindowFuncs::map()[WindowFuncs::WindowTypes::kHann](size, mWindow);
       }
 
-      frame.array() *= mWindow;
+      mFrame.array() *= mWindow;
     }
 
+    autocorrelate(size);
 
-    VectorXd autocorrelation(size);
-    algorithm::autocorrelateReal(autocorrelation.data(), frame.data(),
-                                 asUnsigned(size));
+    // Yule Walker
+    double error = levinsonDurbin();
 
-    // Resize to the desired order (only keep coefficients for up to the order
-    // we need)
-    double pN = mParameters.size() < size ? autocorrelation(mParameters.size())
-                                          : autocorrelation(0);
-    autocorrelation.conservativeResize(mParameters.size());
+    if (updateVariance) setVariance(error / size);
+  }
 
-    // Form a toeplitz matrix
-    MatrixXd mat = toeplitz(autocorrelation);
+  // The first order() + 1 lags of the circular autocorrelation of mFrame, as
+  // autocorrelateReal() would give them, but reusing the FFT setup and
+  // spectrum between calls
+  void autocorrelate(index size)
+  {
+    using namespace impl;
 
-    // Yule Walker
-    autocorrelation(0) = pN;
-    std::rotate(autocorrelation.data(), autocorrelation.data() + 1,
-                autocorrelation.data() + mParameters.size());
-    mParameters = mat.llt().solve(autocorrelation);
+    size_t fftSizeLog2 = ilog2(calcLinearSize(asUnsigned(size),
+                                              asUnsigned(size)));
+    size_t fftSize = size_t{1} << fftSizeLog2;
+
+    if (!mFFTSetup || fftSizeLog2 > mMaxFFTSizeLog2)
+    {
+      mFFTSetup.reset(new FFTRealSetup(fftSizeLog2));
+      mSpectrum.reset(new TempSpectra(fftSize >> 1));
+      mMaxFFTSizeLog2 = fftSizeLog2;
+    }
+
+    FFT_SPLIT_COMPLEX_D& spectrum = mSpectrum->mSpectra;
+
+    transformForwardReal(*mFFTSetup, spectrum, mFrame.data(),
+                         asUnsigned(size), fftSizeLog2);
+
+    // power spectrum, with DC and Nyquist packed in the first bin
+    const double scale = 0.25 / static_cast<double>(fftSize);
+    const double DC = spectrum.realp[0] * spectrum.realp[0] * scale;
+    const double nyquist = spectrum.imagp[0] * spectrum.imagp[0] * scale;
+
+    for (size_t i = 1; i < (fftSize >> 1); i++)
+    {
+      const double re = spectrum.realp[i];
+      const double im = spectrum.imagp[i];
+      spectrum.realp[i] = scale * (re * re + im * im);
+      spectrum.imagp[i] = 0.0;
+    }
+
+    spectrum.realp[0] = DC;
+    spectrum.imagp[0] = nyquist;
 
-    if (updateVariance)
+    transformInverseReal(*mFFTSetup, spectrum, fftSizeLog2);
+
+    // the inverse leaves samples interleaved between realp and imagp
+    auto sample = [&spectrum](size_t i) {
+      return (i & 1U) ? spectrum.imagp[i >> 1] : spectrum.realp[i >> 1];
+    };
+
+    // wrap the negative lags around onto the positive ones
+    const index nLags = std::min(order(), size - 1) + 1;
+    mAutocorrelation(0) = sample(0);
+    for (index i = 1; i < nLags; i++)
+      mAutocorrelation(i) = sample(asUnsigned(i)) +
+                            sample(fftSize - asUnsigned(size - i));
+    mAutocorrelation.tail(order() + 1 - nLags).setZero();
+  }
+
+  // Solves the Yule-Walker equations for mParameters by Levinson-Durbin
+  // recursion over mAutocorrelation, returning the prediction error power
+  double levinsonDurbin()
+  {
+    const VectorXd& r = mAutocorrelation;
+    double          error = r(0);
+
+    mParameters.setZero();
+
+    for (index m = 0; m < order() && error > 0; m++)
     {
-      // Calculate variance
-      double variance = mat(0, 0);
+      double acc = r(m + 1);
+      for (index j = 0; j < m; j++) acc -= mParameters(j) * r(m - j);
+
+      const double k = acc / error;
 
-      for (index i = 0; i < mParameters.size() - 1; i++)
-        variance -= mParameters(i) * mat(0, i + 1);
+      for (index j = 0; j < m / 2; j++)
+      {
+        const double low = mParameters(j);
+        const double high = mParameters(m - 1 - j);
+        mParameters(j) = low - k * high;
+        mParameters(m - 1 - j) = high - k * low;
+      }
 
-      setVariance((variance - (mParameters(mParameters.size() - 1) * pN)) /
-                  size);
+      if (m & 1) mParameters(m / 2) -= k * mParameters(m / 2);
+
+      mParameters(m) = k;
+      error *= (1.0 - k * k);
     }
+
+    return error;
   }
 
   void robustEstimate(const double* input, index size, index nIterations, double robustFactor)
   {
-    std::vector<double> estimates(asUnsigned(size + mParameters.size()));
+    mEstimates.resize(asUnsigned(size + mParameters.size()));
+    double* estimates = mEstimates.data();
 
     // Calculate an initial estimate of parameters
     directEstimate(input, size, true);
 
     // Initialise Estimates
     for (index i = mParameters.size(); i < mParameters.size() + size; i++)
-      estimates[asUnsigned(i)] = input[i - mParameters.size()];
+      estimates[i] = input[i - mParameters.size()];
 
     // Variance
-    robustVariance(estimates.data() + mParameters.size(), input, size, robustFactor);
+    robustVariance(estimates + mParameters.size(), input, size, robustFactor);
 
     // Iterate
     for (index iterations = nIterations; iterations--;)
-      robustIteration(estimates.data() + mParameters.size(), input, size, robustFactor);
+      robustIteration(estimates + mParameters.size(), input, size, robustFactor);
   }
 
   double robustResidual(double input, double prediction, double cs)
@@ -230,6 +295,14 @@ private:
   ArrayXd  mWindow;
   bool     mUseWindow{true};
   double   mMinVariance{0.0};
+
+  // scratch, kept between calls to avoid allocating per estimate
+  VectorXd                            mFrame;
+  VectorXd                            mAutocorrelation;
+  std::vector<double>                 mEstimates;
+  std::unique_ptr<impl::FFTRealSetup> mFFTSetup;
+  std::unique_ptr<impl::TempSpectra>  mSpectrum;
+  size_t                              mMaxFFTSizeLog2{0};
 };
 
 } // namespace algorithm
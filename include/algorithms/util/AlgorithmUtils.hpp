@@ -10,6 +10,7 @@ under the European Union’s Horizon 2020 research and innovation programme
 #pragma once
 
 #include <cmath>
+#include <limits>
 
 namespace fluid {
 namespace algorithm {
@@ -0,0 +1,171 @@
+/*
+Part of the Fluid Corpus Manipulation Project (http://www.flucoma.org/)
+Copyright 2017-2019 University of Huddersfield.
+Licensed under the BSD-3 License.
+See license.md file in the project root for full license information.
+This project has received funding from the European Research Council (ERC)
+under the European Union’s Horizon 2020 research and innovation programme
+(grant agreement No 725899).
+*/
+#pragma once
+
+#include "../../data/FluidIndex.hpp"
+#include "../../data/TensorTypes.hpp"
+#include <Eigen/Core>
+#include <array>
+#include <cassert>
+#include <type_traits>
+
+namespace fluid {
+namespace algorithm {
+
+// y[n] = b0 x[n] + b1 x[n-1] + b2 x[n-2] - a1 y[n-1] - a2 y[n-2]
+struct BiquadCoefficients
+{
+  double b0{1.0}, b1{0.0}, b2{0.0};
+  double a1{0.0}, a2{0.0};
+};
+
+/**
+ A series of biquad sections in transposed direct form II, run over Lanes
+ independent channels at once.
+
+ With one lane, the filter works on plain doubles; with more, each sample
+ step works on a fixed-size Eigen array across the lanes, so that up to 4 or
+ 8 channels share the same SIMD instructions. Block processing keeps the
+ section state in locals for the length of the block.
+ **/
+template <index Sections, index Lanes = 1>
+class BiquadCascade
+{
+  static_assert(Sections > 0 && Lanes > 0, "BiquadCascade: bad dimensions");
+
+  using Value = typename std::conditional<
+      Lanes == 1, double, Eigen::Array<double, Lanes, 1>>::type;
+  using State =
+      Eigen::Array<double, Lanes, Sections,
+                   Eigen::DontAlign | (Lanes == 1 && Sections > 1
+                                           ? Eigen::RowMajor
+                                           : Eigen::ColMajor)>;
+
+public:
+  using Coefficients = std::array<BiquadCoefficients, Sections>;
+
+  void init(const Coefficients& coefficients)
+  {
+    mCoefficients = coefficients;
+    reset();
+  }
+
+  void reset()
+  {
+    mS1.setZero();
+    mS2.setZero();
+  }
+
+  double processSample(double x)
+  {
+    static_assert(Lanes == 1, "BiquadCascade: processSample is single lane");
+    run(1, [x](index, double& v) { v = x; }, [&x](index, double v) { x = v; });
+    return x;
+  }
+
+  // filters n contiguous samples; in and out may be the same
+  void process(const double* in, double* out, index n)
+  {
+    static_assert(Lanes == 1, "BiquadCascade: use the multichannel process");
+    run(n, [in](index i, double& v) { v = in[i]; },
+        [out](index i, double v) { out[i] = v; });
+  }
+
+  // filters each row of in (one channel per lane, up to Lanes of them) into
+  // the same row of out; in and out may be the same
+  void process(const RealMatrixView in, RealMatrixView out)
+  {
+    assert(in.rows() <= Lanes && in.rows() == out.rows());
+    assert(in.cols() == out.cols());
+    if (in.rows() == Lanes)
+      processRows<Lanes>(in, out);
+    else
+      processRows<0>(in, out);
+  }
+
+private:
+  // FixedChannels is the number of rows when known, so that the loops over
+  // lanes unroll, or 0
+  template <index FixedChannels>
+  void processRows(const RealMatrixView in, RealMatrixView out)
+  {
+    index         channels = FixedChannels ? FixedChannels : in.rows();
+    const double* inData = in.data();
+    double*       outData = out.data();
+    auto          inStrides = in.descriptor().strides;
+    auto          outStrides = out.descriptor().strides;
+    run(
+        in.cols(),
+        [=](index i, Value& v) {
+          if (!FixedChannels) v.setZero();
+          for (index c = 0; c < channels; c++)
+            v(c) = inData[c * inStrides[0] + i * inStrides[1]];
+        },
+        [=](index i, const Value& v) {
+          for (index c = 0; c < channels; c++)
+            outData[c * outStrides[0] + i * outStrides[1]] = v(c);
+        });
+  }
+
+  template <typename Load, typename Store>
+  void run(index n, Load load, Store store)
+  {
+    std::array<Value, Sections> s1, s2;
+    for (index k = 0; k < Sections; k++)
+    {
+      get(mS1, k, s1[asUnsigned(k)]);
+      get(mS2, k, s2[asUnsigned(k)]);
+    }
+    Value x, y;
+    for (index i = 0; i < n; i++)
+    {
+      load(i, x);
+      for (index k = 0; k < Sections; k++)
+      {
+        const BiquadCoefficients& c = mCoefficients[asUnsigned(k)];
+        Value& z1 = s1[asUnsigned(k)];
+        Value& z2 = s2[asUnsigned(k)];
+        y = c.b0 * x + z1;
+        z1 = c.b1 * x - c.a1 * y + z2;
+        z2 = c.b2 * x - c.a2 * y;
+        x = y;
+      }
+      store(i, x);
+    }
+    for (index k = 0; k < Sections; k++)
+    {
+      set(mS1, k, s1[asUnsigned(k)]);
+      set(mS2, k, s2[asUnsigned(k)]);
+    }
+  }
+
+  static void get(const State& s, index k, double& v) { v = s(0, k); }
+
+  template <typename V>
+  static void get(const State& s, index k, V& v)
+  {
+    v = s.col(k);
+  }
+
+  static void set(State& s, index k, double v) { s(0, k) = v; }
+
+  template <typename V>
+  static void set(State& s, index k, const V& v)
+  {
+    s.col(k) = v;
+  }
+
+  Coefficients mCoefficients;
+  State        mS1{State::Zero()};
+  State        mS2{State::Zero()};
+};
+
+} // namespace algorithm
+} // namespace fluid
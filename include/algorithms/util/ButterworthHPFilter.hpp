@@ -10,7 +10,7 @@ under the European Union’s Horizon 2020 research and innovation programme
 #pragma once
 
 #include "../util/AlgorithmUtils.hpp"
-#include <cassert>
+#include "../util/BiquadCascade.hpp"
 #include <cmath>
 
 namespace fluid {
@@ -19,38 +19,34 @@ namespace algorithm {
 class ButterworthHPFilter
 {
 public:
-  void init(double cutoff)
-  { // as fraction of sample rate
+  // cutoff as fraction of sample rate
+  static BiquadCoefficients coefficients(double cutoff)
+  {
     using namespace std;
-    double c = tan(pi * cutoff);
-    mB0 = 1.0 / (1.0 + sqrtTwo * c + pow(c, 2.0));
-    mB1 = -2.0 * mB0;
-    mB2 = mB0;
-    mA0 = 2.0 * mB0 * (pow(c, 2.0) - 1.0);
-    mA1 = mB0 * (1.0 - sqrtTwo * c + pow(c, 2.0));
-    mXnz1 = 0;
-    mXnz2 = 0;
-    mYnz1 = 0;
-    mYnz2 = 0;
+    double             c = tan(pi * cutoff);
+    BiquadCoefficients coeffs;
+    coeffs.b0 = 1.0 / (1.0 + sqrtTwo * c + pow(c, 2.0));
+    coeffs.b1 = -2.0 * coeffs.b0;
+    coeffs.b2 = coeffs.b0;
+    coeffs.a1 = 2.0 * coeffs.b0 * (pow(c, 2.0) - 1.0);
+    coeffs.a2 = coeffs.b0 * (1.0 - sqrtTwo * c + pow(c, 2.0));
+    return coeffs;
   }
 
-  double processSample(double x)
+  void init(double cutoff) { mFilter.init({{coefficients(cutoff)}}); }
+
+  void reset() { mFilter.reset(); }
+
+  double processSample(double x) { return mFilter.processSample(x); }
+
+  // in and out may be the same
+  void process(const double* in, double* out, index n)
   {
-    double y = mB0 * x + mB1 * mXnz1 + mB2 * mXnz2 - mA0 * mYnz1 - mA1 * mYnz2;
-    mXnz2 = mXnz1;
-    mXnz1 = x;
-    mYnz2 = mYnz1;
-    mYnz1 = y;
-    return y;
+    mFilter.process(in, out, n);
   }
 
 private:
-  double mB0{0.0}, mB1{0.0}, mB2{0.0};
-  double mA0{0.0}, mA1{0.0};
-  double mXnz1{0.0};
-  double mXnz2{0.0};
-  double mYnz1{0.0};
-  double mYnz2{0.0};
+  BiquadCascade<1> mFilter;
 };
 } // namespace algorithm
 } // namespace fluid
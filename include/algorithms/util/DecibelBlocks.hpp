@@ -0,0 +1,73 @@
+/*
+Part of the Fluid Corpus Manipulation Project (http://www.flucoma.org/)
+Copyright 2017-2019 University of Huddersfield.
+Licensed under the BSD-3 License.
+See license.md file in the project root for full license information.
+This project has received funding from the European Research Council (ERC)
+under the European Union’s Horizon 2020 research and innovation programme
+(grant agreement No 725899).
+*/
+#pragma once
+
+#include "FastLog.hpp"
+#include "../../data/FluidIndex.hpp"
+#include "../../data/TensorTypes.hpp"
+#include <Eigen/Core>
+#include <algorithm>
+#include <array>
+#include <cassert>
+
+namespace fluid {
+namespace algorithm {
+
+/**
+ Block front end shared by the amplitude envelope followers (EnvelopeGate,
+ EnvelopeSegmentation). Input is taken kSize samples at a time and high-passed,
+ rectified and converted to dB in passes that vectorise, before each value goes
+ through the follower's per-sample state machine.
+ **/
+class DecibelBlocks
+{
+public:
+  static constexpr index kSize = 64;
+
+  // rectifies and converts to dB clipped at floor, in place, optionally with
+  // an approximate log10 (see fastLog10)
+  static void toDecibels(double* x, index size, double floor,
+                         bool approximateLog)
+  {
+    if (approximateLog)
+    {
+      for (index i = 0; i < size; i++)
+        x[i] = std::max(20 * fastLog10(x[i]), floor);
+    }
+    else
+    {
+      Eigen::Map<Eigen::ArrayXd> block(x, size);
+      block = (20 * block.abs().log10()).max(floor);
+    }
+  }
+
+  // out(i) = follow(dB(i)); hiPass is skipped when null, and in and out may
+  // be the same
+  template <typename Filter, typename Follow>
+  static void process(const RealVectorView in, RealVectorView out,
+                      Filter* hiPass, double floor, bool approximateLog,
+                      Follow&& follow)
+  {
+    assert(in.size() == out.size());
+    std::array<double, kSize> block;
+    for (index start = 0; start < in.size(); start += kSize)
+    {
+      index size = std::min(in.size() - start, index(kSize));
+      for (index i = 0; i < size; i++) block[asUnsigned(i)] = in(start + i);
+      if (hiPass) hiPass->process(block.data(), block.data(), size);
+      toDecibels(block.data(), size, floor, approximateLog);
+      for (index i = 0; i < size; i++)
+        out(start + i) = follow(block[asUnsigned(i)]);
+    }
+  }
+};
+
+} // namespace algorithm
+} // namespace fluid
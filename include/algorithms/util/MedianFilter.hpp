@@ -11,12 +11,26 @@ under the European Union’s Horizon 2020 research and innovation programme
 
 #include "../../data/FluidIndex.hpp"
 #include "../../data/FluidTensor.hpp"
+#include "../../data/TensorTypes.hpp"
+#include <algorithm>
+#include <array>
 #include <cassert>
-#include <deque>
+#include <initializer_list>
+#include <utility>
+#include <vector>
 
 namespace fluid {
 namespace algorithm {
 
+/**
+ Running median over the last size() samples, starting from a window of
+ zeros.
+
+ Windows of up to 9 samples are handled by selection networks over the
+ window. Larger windows keep a max-heap below the median and a min-heap above
+ it, sharing one array with the median in the middle (after A. Shelly's
+ "Mediator"), so each sample costs O(log size) comparisons.
+ **/
 class MedianFilter
 {
 
@@ -27,38 +41,38 @@ public:
     assert(size % 2);
     mFilterSize = size;
     mMiddle = (mFilterSize - 1) / 2;
-    mUnsorted.resize(asUnsigned(mFilterSize), 0);
-    mSorted.resize(asUnsigned(mFilterSize), 0);
+    mData.assign(asUnsigned(mFilterSize), 0);
+    mPos.resize(asUnsigned(mFilterSize));
+    mHeap.resize(asUnsigned(mFilterSize));
+    // initial fill: median, max, min, max, min...
+    for (index i = 0; i < mFilterSize; ++i)
+    {
+      index p = ((i + 1) / 2) * ((i & 1) ? -1 : 1);
+      mPos[asUnsigned(i)] = p;
+      heap(p) = i;
+    }
+    mIdx = 0;
     mInitialized = true;
   }
 
   double processSample(double val)
   {
     assert(mInitialized);
-    mUnsorted.push_back(val);
-    double old = mUnsorted.front();
-    mUnsorted.pop_front();
-    for (auto it = mSorted.begin(); it != mSorted.end(); ++it)
-    {
-      if ((*it) == old)
-      {
-        it = mSorted.erase(it);
-        break;
-      }
-    }
-    if (val <= mSorted.front())
-      mSorted.push_front(val);
-    else if (val >= mSorted.back())
-      mSorted.push_back(val);
-    else
+    switch (mFilterSize)
     {
-      auto it = mSorted.begin();
-      while (*it < val) it++;
-      mSorted.insert(it, val);
+    case 3: return push(val), median3();
+    case 5: return push(val), median5();
+    case 7: return push(val), median7();
+    case 9: return push(val), median9();
+    default: return insert(val);
     }
-    auto it = mSorted.begin();
-    std::advance(it, mMiddle);
-    return *it;
+  }
+
+  // runs the filter over a block of samples; in and out may be the same
+  void process(const RealVectorView in, RealVectorView out)
+  {
+    assert(in.size() == out.size());
+    for (index i = 0; i < in.size(); ++i) out(i) = processSample(in(i));
   }
 
   index size() { return mFilterSize; }
@@ -66,12 +80,140 @@ public:
   bool initialized() { return mInitialized; }
 
 private:
+  void push(double val)
+  {
+    mData[asUnsigned(mIdx)] = val;
+    if (++mIdx == mFilterSize) mIdx = 0;
+  }
+
+  // selection networks (Paeth, Devillard): compare-exchange pairs after which
+  // the middle element holds the median
+  using Network = std::initializer_list<std::pair<int, int>>;
+
+  template <size_t N>
+  double select(Network network)
+  {
+    std::array<double, N> p;
+    std::copy_n(mData.begin(), N, p.begin());
+    for (auto& s : network)
+    {
+      double lo = std::min(p[s.first], p[s.second]);
+      p[s.second] = std::max(p[s.first], p[s.second]);
+      p[s.first] = lo;
+    }
+    return p[N / 2];
+  }
+
+  double median3()
+  {
+    return select<3>({{0, 1}, {1, 2}, {0, 1}});
+  }
+
+  double median5()
+  {
+    return select<5>(
+        {{0, 1}, {3, 4}, {0, 3}, {1, 4}, {1, 2}, {2, 3}, {1, 2}});
+  }
+
+  double median7()
+  {
+    return select<7>({{0, 5}, {0, 3}, {1, 6}, {2, 4}, {0, 1}, {3, 5}, {2, 6},
+                      {2, 3}, {3, 6}, {4, 5}, {1, 4}, {1, 3}, {3, 4}});
+  }
+
+  double median9()
+  {
+    return select<9>({{1, 2}, {4, 5}, {7, 8}, {0, 1}, {3, 4}, {6, 7}, {1, 2},
+                      {4, 5}, {7, 8}, {0, 3}, {5, 8}, {4, 7}, {3, 6}, {1, 4},
+                      {2, 5}, {4, 7}, {4, 2}, {6, 4}, {4, 2}});
+  }
+
+  // Heap positions run from -mMiddle to mMiddle: 0 is the median, negative
+  // positions the max-heap of smaller values, positive the min-heap of larger
+  // ones, with the children of p at 2p and 2p +/- 1.
+  index& heap(index p) { return mHeap[asUnsigned(p + mMiddle)]; }
+
+  bool less(index i, index j)
+  {
+    return mData[asUnsigned(heap(i))] < mData[asUnsigned(heap(j))];
+  }
+
+  // swaps i and j if heap(i) < heap(j)
+  bool exchangeIfLess(index i, index j)
+  {
+    if (!less(i, j)) return false;
+    std::swap(heap(i), heap(j));
+    mPos[asUnsigned(heap(i))] = i;
+    mPos[asUnsigned(heap(j))] = j;
+    return true;
+  }
+
+  void minSortDown(index i)
+  {
+    for (i *= 2; i <= mMiddle; i *= 2)
+    {
+      if (i < mMiddle && less(i + 1, i)) ++i;
+      if (!exchangeIfLess(i, i / 2)) break;
+    }
+  }
+
+  void maxSortDown(index i)
+  {
+    for (i *= 2; i >= -mMiddle; i *= 2)
+    {
+      if (i > -mMiddle && less(i, i - 1)) --i;
+      if (!exchangeIfLess(i / 2, i)) break;
+    }
+  }
+
+  // both return true if the item reached the median
+  bool minSortUp(index i)
+  {
+    while (i > 0 && exchangeIfLess(i, i / 2)) i /= 2;
+    return i == 0;
+  }
+
+  bool maxSortUp(index i)
+  {
+    while (i < 0 && exchangeIfLess(i / 2, i)) i /= 2;
+    return i == 0;
+  }
+
+  double insert(double val)
+  {
+    index  p = mPos[asUnsigned(mIdx)];
+    double old = mData[asUnsigned(mIdx)];
+    push(val);
+    if (p > 0)
+    {
+      if (old < val)
+        minSortDown(p);
+      else if (minSortUp(p) && exchangeIfLess(0, -1))
+        maxSortDown(-1);
+    }
+    else if (p < 0)
+    {
+      if (val < old)
+        maxSortDown(p);
+      else if (maxSortUp(p) && exchangeIfLess(1, 0))
+        minSortDown(1);
+    }
+    else
+    {
+      if (maxSortUp(-1)) maxSortDown(-1);
+      if (minSortUp(1)) minSortDown(1);
+    }
+    return mData[asUnsigned(heap(0))];
+  }
+
   index mFilterSize{0};
   index mMiddle{0};
+  index mIdx{0};
   bool  mInitialized{false};
 
-  std::deque<double> mUnsorted;
-  std::deque<double> mSorted;
+  std::vector<double> mData; // the window, as a ring
+  std::vector<index>  mPos;  // heap position of each window slot
+  std::vector<index>  mHeap; // window slots, in heap order
 };
 } // namespace algorithm
 } // namespace fluid
@@ -14,75 +14,99 @@ under the European Union’s Horizon 2020 research and innovation programme
 #include "../util/AlgorithmUtils.hpp"
 #include "../../data/FluidIndex.hpp"
 #include <Eigen/Core>
+#include <algorithm>
+#include <cassert>
+#include <cmath>
 
 namespace fluid {
 namespace algorithm {
 
 // This implements Foote's novelty curve
+//
+// The last kernelSize frames are kept in a ring, with their norms, and their
+// similarities in a matching ring of rows and columns, so each frame only
+// computes its own similarity to the others. The checkerboard kernel is the
+// outer product of a signed Gaussian w, so the novelty is the quadratic form
+// w' S w, taken over the ring with w rotated to match.
 class Novelty
 {
 
 public:
   using ArrayXd = Eigen::ArrayXd;
-  using ArrayXXd = Eigen::ArrayXXd;
   using MatrixXd = Eigen::MatrixXd;
   using VectorXd = Eigen::VectorXd;
 
-  Novelty(index maxSize) : mKernelStorage(maxSize, maxSize) {}
+  Novelty(index maxSize)
+      : mWeightStorage(maxSize), mRotatedWeights(maxSize), mRow(maxSize),
+        mProduct(maxSize)
+  {}
 
   void init(index kernelSize, index nDims)
   {
     assert(kernelSize % 2);
+    assert(kernelSize <= mWeightStorage.size());
     mKernelSize = kernelSize;
     mNDims = nDims;
     createKernel();
     mSimilarity = MatrixXd::Zero(mKernelSize, mKernelSize);
-    mBufer = MatrixXd::Zero(mKernelSize, nDims);
+    mFrames = MatrixXd::Zero(nDims, mKernelSize);
+    mNorms = ArrayXd::Constant(mKernelSize, epsilon);
+    mPos = 0;
   }
 
-  double processFrame(const ArrayXd& input)
+  template <typename Derived>
+  double processFrame(const Eigen::ArrayBase<Derived>& input)
   {
-    using std::vector;
-    mBufer.block(0, 0, mKernelSize - 1, mNDims) =
-        mBufer.block(1, 0, mKernelSize - 1, mNDims);
-    ArrayXXd x = mBufer.block(mKernelSize - 1, 0, 1, mNDims);
-    VectorXd in1 = input.matrix();
-    mBufer.block(mKernelSize - 1, 0, 1, mNDims) = in1.transpose();
-    VectorXd tmp = mBufer * input.matrix();
-    VectorXd norm =
-        mBufer.rowwise().norm().cwiseMax(epsilon) * input.matrix().norm();
-    norm = norm.cwiseMax(epsilon);
-    tmp = (tmp.array() / norm.array()).matrix();
-    mSimilarity.block(0, 0, mKernelSize - 1, mKernelSize - 1) =
-        mSimilarity.block(1, 1, mKernelSize - 1, mKernelSize - 1);
-    ArrayXXd x1 = mSimilarity.block(0, mKernelSize - 1, mKernelSize, 1);
-    mSimilarity.block(0, mKernelSize - 1, mKernelSize, 1) = tmp;
-    mSimilarity.block(mKernelSize - 1, 0, 1, mKernelSize) = tmp.transpose();
-    double result = (mSimilarity.array() * mKernel).sum();
-    return result / mNorm;
+    assert(input.size() == mNDims);
+    index K = mKernelSize;
+    // the new frame replaces the oldest
+    mFrames.col(mPos) = input.matrix();
+    double inputNorm = mFrames.col(mPos).norm();
+    mNorms(mPos) = std::max(inputNorm, epsilon);
+    auto row = mRow.head(K);
+    row.noalias() = mFrames.transpose() * mFrames.col(mPos);
+    row.array() /= (mNorms * inputNorm).max(epsilon);
+    mSimilarity.row(mPos) = row.transpose();
+    mSimilarity.col(mPos) = row;
+
+    // slot q holds window position (q - oldest) mod K
+    index oldest = (mPos + 1) % K;
+    auto  w = mWeightStorage.head(K);
+    auto  rotated = mRotatedWeights.head(K);
+    rotated.segment(oldest, K - oldest) = w.head(K - oldest);
+    rotated.head(oldest) = w.tail(oldest);
+    mPos = oldest;
+
+    auto product = mProduct.head(K);
+    product.noalias() = mSimilarity * rotated;
+    return rotated.dot(product) / mNorm;
   }
 
 private:
   void createKernel()
   {
-    mKernel = mKernelStorage.block(0, 0, mKernelSize, mKernelSize);
     index   h = (mKernelSize - 1) / 2;
     ArrayXd gaussian = ArrayXd::Zero(mKernelSize);
     WindowFuncs::map()[WindowFuncs::WindowTypes::kGaussian](mKernelSize,
                                                             gaussian);
-    MatrixXd tmp = gaussian.matrix() * gaussian.matrix().transpose();
-    tmp.block(h, 0, h + 1, h) *= -1;
-    tmp.block(0, h, h, h + 1) *= -1;
-    mKernel = tmp.array();
-    mNorm = mKernel.square().sum();
+    // the kernel is w w', negative where one frame is before the centre and
+    // the other is not
+    auto w = mWeightStorage.head(mKernelSize);
+    w = gaussian.matrix();
+    w.head(h) *= -1;
+    mNorm = std::pow(w.squaredNorm(), 2);
   }
 
   index    mKernelSize{3};
   index    mNDims{513};
-  ArrayXXd mKernel;
-  ArrayXXd mKernelStorage;
+  index    mPos{0};
+  VectorXd mWeightStorage;
+  VectorXd mRotatedWeights;
+  VectorXd mRow;
+  VectorXd mProduct;
+  ArrayXd  mNorms;
   MatrixXd mSimilarity;
-  MatrixXd mBufer;
+  MatrixXd mFrames;
   double   mNorm{1.};
 };
 } // namespace algorithm
@@ -15,7 +15,7 @@ under the European Union’s Horizon 2020 research and innovation programme
 #include <Eigen/Core>
 #include <cassert>
 #include <cmath>
-#include <map>
+#include <complex>
 
 namespace fluid {
 namespace algorithm {
@@ -39,95 +39,196 @@ public:
 
   using ArrayXcd = Eigen::ArrayXcd;
   using ArrayXd = Eigen::ArrayXd;
-  using ODFMap =
-      std::map<ODF, std::function<double(ArrayXcd, ArrayXcd, ArrayXcd)>>;
 
-  static ArrayXd wrapPhase(ArrayXd phase)
+  /**
+   A spectral frame with its magnitudes and phases, each computed once
+   however many calls use the frame. Phases are only computed when a
+   function needs them.
+   **/
+  class Frame
   {
-    return phase.unaryExpr([=](const double p) {
-      return p > (-pi) && p > pi
-                 ? p
-                 : p + (twoPi) * (1.0 + floor((-pi - p)  / twoPi));
-    });
+  public:
+    void init(index maxSize)
+    {
+      mSpectrum.resize(maxSize);
+      mMag.resize(maxSize);
+      mPhase.resize(maxSize);
+      reset(maxSize);
+    }
+
+    void reset(index size)
+    {
+      assert(size <= mSpectrum.size());
+      mSize = size;
+      mSpectrum.head(mSize).setZero();
+      mMag.head(mSize).setZero();
+      mPhase.head(mSize).setZero();
+      mHasPhase = true;
+    }
+
+    void set(const Eigen::Ref<const ArrayXcd>& spectrum)
+    {
+      assert(spectrum.size() <= mSpectrum.size());
+      mSize = spectrum.size();
+      mSpectrum.head(mSize) = spectrum;
+      mMag.head(mSize) = spectrum.abs();
+      mHasPhase = false;
+    }
+
+    void computePhase()
+    {
+      if (mHasPhase) return;
+      mPhase.head(mSize) = mSpectrum.head(mSize).atan().real();
+      mHasPhase = true;
+    }
+
+    auto spectrum() const { return mSpectrum.head(mSize); }
+    auto mag() const { return mMag.head(mSize); }
+    auto phase() const
+    {
+      assert(mHasPhase);
+      return mPhase.head(mSize);
+    }
+    index size() const { return mSize; }
+
+  private:
+    ArrayXcd mSpectrum;
+    ArrayXd  mMag;
+    ArrayXd  mPhase;
+    index    mSize{0};
+    bool     mHasPhase{true};
+  };
+
+  static double wrapPhase(double p)
+  {
+    return p > (-pi) && p > pi
+               ? p
+               : p + (twoPi) * (1.0 + std::floor((-pi - p) / twoPi));
+  }
+
+  template <typename Derived>
+  static auto wrapPhase(const Eigen::ArrayBase<Derived>& phase)
+  {
+    return phase.unaryExpr([](const double p) { return wrapPhase(p); });
   }
 
-  static ODFMap& map()
-  {
-    static ODFMap _funcs = {
-
-        {ODF::kEnergy,
-         [](ArrayXcd cur, ArrayXcd /*prev*/, ArrayXcd /*prevprev*/) {
-           return cur.abs().real().square().mean();
-         }},
-        {ODF::kHFC,
-         [](ArrayXcd cur, ArrayXcd /*prev*/, ArrayXcd /*prevprev*/) {
-           index   n = cur.size();
-           ArrayXd space = ArrayXd(n);
-           space.setLinSpaced(0, n);
-           return (space * cur.abs().real().square()).mean();
-         }},
-        {ODF::kSpectralFlux,
-         [](ArrayXcd cur, ArrayXcd prev, ArrayXcd /*prevprev*/) {
-           return (cur.abs().real() - prev.abs().real()).max(0.0).mean();
-         }},
-        {ODF::kMKL,
-         [](ArrayXcd cur, ArrayXcd prev, ArrayXcd /*prevprev*/) {
-           ArrayXd mag1 = cur.abs().real().max(epsilon);
-           ArrayXd mag2 = prev.abs().real().max(epsilon);
-           return (mag1 / mag2).max(epsilon).log().mean();
-         }},
-        {ODF::kIS,
-         [](ArrayXcd cur, ArrayXcd prev, ArrayXcd /*prevprev*/) {
-           ArrayXd mag1 = cur.abs().real().max(epsilon);
-           ArrayXd mag2 = prev.abs().real().max(epsilon);
-           ArrayXd ratio = (mag1 / mag2).square().max(epsilon);
-           return (ratio - ratio.log() - 1).mean();
-         }},
-        {ODF::kCosine,
-         [](ArrayXcd cur, ArrayXcd prev, ArrayXcd /*prevprev*/) {
-           ArrayXd mag1 = cur.abs().real().max(epsilon);
-           ArrayXd mag2 = prev.abs().real().max(epsilon);
-           double  norm = mag1.matrix().norm() * mag2.matrix().norm();
-           double  dot = mag1.matrix().dot(mag2.matrix());
-           return dot / norm;
-         }},
-        {ODF::kPhaseDev,
-         [](ArrayXcd cur, ArrayXcd prev, ArrayXcd prevprev) {
-           ArrayXd phaseAcc = (cur.atan().real() - prev.atan().real()) -
-                              (prev.atan().real() - prevprev.atan().real());
-           return wrapPhase(phaseAcc).mean();
-         }},
-        {ODF::kWPhaseDev,
-         [](ArrayXcd cur, ArrayXcd prev, ArrayXcd prevprev) {
-           ArrayXd mag1 = cur.abs().real().max(epsilon);
-           ArrayXd phaseAcc = (cur.atan().real() - prev.atan().real()) -
-                              (prev.atan().real() - prevprev.atan().real());
-           return wrapPhase(mag1 * phaseAcc).mean();
-         }},
-        {ODF::kComplexDev,
-         [](ArrayXcd cur, ArrayXcd prev, ArrayXcd prevprev) {
-           ArrayXcd target(cur.size());
-           ArrayXd  prevMag = prev.abs().real().max(epsilon);
-           ArrayXd  prevPhase = prev.atan().real();
-           ArrayXd  phaseEst = wrapPhase(
-               prevPhase + (prev.atan().real() - prevprev.atan().real()));
-           target.real() = prevMag * phaseEst.cos();
-           target.imag() = prevMag * phaseEst.sin();
-           return (target - cur).abs().real().mean();
-         }},
-        {ODF::kRComplexDev,
-         [](ArrayXcd cur, ArrayXcd prev, ArrayXcd prevprev) {
-           ArrayXcd target(cur.size());
-           ArrayXd  prevMag = prev.abs().real().max(epsilon);
-           ArrayXd  prevPhase = prev.atan().real();
-           ArrayXd  phaseEst = wrapPhase(
-               prevPhase + (prev.atan().real() - prevprev.atan().real()));
-           target.real() = prevMag * phaseEst.cos();
-           target.imag() = prevMag * phaseEst.sin();
-           return (target - cur).abs().real().max(0.0).mean();
-         }},
-    };
-    return _funcs;
+  static bool usesPhase(ODF function)
+  {
+    return function == ODF::kPhaseDev || function == ODF::kWPhaseDev ||
+           function == ODF::kComplexDev || function == ODF::kRComplexDev;
+  }
+
+  static double process(ODF function, Frame& cur, Frame& prev,
+                        Frame& prevPrev)
+  {
+    assert(cur.size() == prev.size() && cur.size() == prevPrev.size());
+    if (usesPhase(function))
+    {
+      cur.computePhase();
+      prev.computePhase();
+      prevPrev.computePhase();
+    }
+    switch (function)
+    {
+    case ODF::kEnergy: return energy(cur);
+    case ODF::kHFC: return hfc(cur);
+    case ODF::kSpectralFlux: return spectralFlux(cur, prev);
+    case ODF::kMKL: return mkl(cur, prev);
+    case ODF::kIS: return itakuraSaito(cur, prev);
+    case ODF::kCosine: return cosine(cur, prev);
+    case ODF::kPhaseDev: return phaseDev(cur, prev, prevPrev);
+    case ODF::kWPhaseDev: return weightedPhaseDev(cur, prev, prevPrev);
+    case ODF::kComplexDev: return complexDev(cur, prev, prevPrev);
+    case ODF::kRComplexDev: return rectifiedComplexDev(cur, prev, prevPrev);
+    }
+    return 0;
+  }
+
+private:
+  static double energy(const Frame& cur) { return cur.mag().square().mean(); }
+
+  static double hfc(const Frame& cur)
+  {
+    index n = cur.size();
+    return (ArrayXd::LinSpaced(n, 0, n) * cur.mag().square()).mean();
+  }
+
+  static double spectralFlux(const Frame& cur, const Frame& prev)
+  {
+    return (cur.mag() - prev.mag()).max(0.0).mean();
+  }
+
+  static double mkl(const Frame& cur, const Frame& prev)
+  {
+    return (cur.mag().max(epsilon) / prev.mag().max(epsilon))
+        .max(epsilon)
+        .log()
+        .mean();
+  }
+
+  static double itakuraSaito(const Frame& cur, const Frame& prev)
+  {
+    auto ratio = (cur.mag().max(epsilon) / prev.mag().max(epsilon))
+                     .square()
+                     .max(epsilon);
+    return (ratio - ratio.log() - 1).mean();
+  }
+
+  static double cosine(const Frame& cur, const Frame& prev)
+  {
+    auto   mag1 = cur.mag().max(epsilon).matrix();
+    auto   mag2 = prev.mag().max(epsilon).matrix();
+    double norm = mag1.norm() * mag2.norm();
+    double dot = mag1.dot(mag2);
+    return dot / norm;
+  }
+
+  static auto phaseAcceleration(const Frame& cur, const Frame& prev,
+                                const Frame& prevPrev)
+  {
+    return (cur.phase() - prev.phase()) - (prev.phase() - prevPrev.phase());
+  }
+
+  static double phaseDev(const Frame& cur, const Frame& prev,
+                         const Frame& prevPrev)
+  {
+    return wrapPhase(phaseAcceleration(cur, prev, prevPrev)).mean();
+  }
+
+  static double weightedPhaseDev(const Frame& cur, const Frame& prev,
+                                 const Frame& prevPrev)
+  {
+    return wrapPhase(cur.mag().max(epsilon) *
+                     phaseAcceleration(cur, prev, prevPrev))
+        .mean();
+  }
+
+  // distance of each bin from where steady magnitude and phase advance from
+  // the previous frames would put it
+  static auto complexDeviation(const Frame& cur, const Frame& prev,
+                               const Frame& prevPrev)
+  {
+    auto prevMag = prev.mag().max(epsilon);
+    auto phaseEst =
+        wrapPhase(prev.phase() + (prev.phase() - prevPrev.phase()));
+    auto target = (prevMag * phaseEst.cos())
+                      .binaryExpr(prevMag * phaseEst.sin(),
+                                  [](double re, double im) {
+                                    return std::complex<double>(re, im);
+                                  });
+    return (target - cur.spectrum()).abs();
+  }
+
+  static double complexDev(const Frame& cur, const Frame& prev,
+                           const Frame& prevPrev)
+  {
+    return complexDeviation(cur, prev, prevPrev).mean();
+  }
+
+  static double rectifiedComplexDev(const Frame& cur, const Frame& prev,
+                                    const Frame& prevPrev)
+  {
+    return complexDeviation(cur, prev, prevPrev).max(0.0).mean();
   }
 };
 } // namespace algorithm
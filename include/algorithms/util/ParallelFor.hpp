@@ -0,0 +1,118 @@
+/*
+Part of the Fluid Corpus Manipulation Project (http://www.flucoma.org/)
+Copyright 2017-2019 University of Huddersfield.
+Licensed under the BSD-3 License.
+See license.md file in the project root for full license information.
+This project has received funding from the European Research Council (ERC)
+under the European Union’s Horizon 2020 research and innovation programme
+(grant agreement No 725899).
+*/
+#pragma once
+
+#include "../../data/FluidIndex.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace fluid {
+namespace algorithm {
+
+// Number of workers to use when the caller doesn't say
+inline index defaultThreadCount()
+{
+  return std::max<index>(
+      1, static_cast<index>(std::thread::hardware_concurrency()));
+}
+
+/**
+ Calls f(i) for every i in [0, n), sharing the work between up to nThreads
+ threads (the calling thread included). Jobs are handed out one at a time, so
+ uneven jobs still balance. Intended for NRT work only: threads are started
+ and joined on each call.
+ **/
+template <typename F>
+void parallelFor(index n, F&& f, index nThreads = defaultThreadCount())
+{
+  nThreads = std::min(nThreads, n);
+  if (nThreads <= 1)
+  {
+    for (index i = 0; i < n; ++i) f(i);
+    return;
+  }
+
+  std::atomic<index> next{0};
+  auto               worker = [&next, &f, n]() {
+    for (index i = next++; i < n; i = next++) f(i);
+  };
+
+  std::vector<std::thread> threads;
+  threads.reserve(asUnsigned(nThreads - 1));
+  for (index i = 1; i < nThreads; ++i) threads.emplace_back(worker);
+  worker();
+  for (auto& t : threads) t.join();
+}
+
+/**
+ Like parallelFor(), but the jobs all run on nThreads new threads, and the
+ calling thread only calls poll(): whenever a job finishes, at least every
+ interval, and once more after the last job. This keeps everything that must
+ happen on the calling thread there, such as reporting progress, checking for
+ cancellation, or writing finished results to host buffers.
+ **/
+template <typename F, typename Poll>
+void parallelForPolled(index n, F&& f, Poll&& poll,
+                       index nThreads = defaultThreadCount(),
+                       std::chrono::milliseconds interval =
+                           std::chrono::milliseconds(50))
+{
+  nThreads = std::max<index>(1, std::min(nThreads, n));
+
+  std::atomic<index>      next{0};
+  std::mutex              mutex;
+  std::condition_variable changed;
+  index                   jobsDone = 0;    // guarded by mutex
+  index                   workersDone = 0; // guarded by mutex
+
+  auto worker = [&]() {
+    for (index i = next++; i < n; i = next++)
+    {
+      f(i);
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        ++jobsDone;
+      }
+      changed.notify_one();
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      ++workersDone;
+    }
+    changed.notify_one();
+  };
+
+  std::vector<std::thread> threads;
+  threads.reserve(asUnsigned(nThreads));
+  for (index i = 0; i < nThreads; ++i) threads.emplace_back(worker);
+
+  std::unique_lock<std::mutex> lock(mutex);
+  index                        seen = 0;
+  while (workersDone < nThreads)
+  {
+    changed.wait_for(lock, interval, [&]() {
+      return jobsDone != seen || workersDone == nThreads;
+    });
+    seen = jobsDone;
+    lock.unlock();
+    poll();
+    lock.lock();
+  }
+  lock.unlock();
+  for (auto& t : threads) t.join();
+}
+
+} // namespace algorithm
+} // namespace fluid
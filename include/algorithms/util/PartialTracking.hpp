@@ -16,10 +16,15 @@ Capability through Linear Programming". Proceedings of DAFx-2018.
 #pragma once
 
 #include "../util/Munkres.hpp"
+#include "../util/SparseAssignment.hpp"
 #include "../../data/FluidIndex.hpp"
 #include <Eigen/Core>
+#include <algorithm>
+#include <cassert>
 #include <cmath>
-#include <queue>
+#include <limits>
+#include <tuple>
+#include <vector>
 
 namespace fluid {
 namespace algorithm {
@@ -33,15 +38,59 @@ struct SinePeak
 
 struct SineTrack
 {
+  // the most recent peaks of the track, as a ring indexed by frame
   std::vector<SinePeak> peaks;
 
   index startFrame;
   index endFrame;
+  index length;
   bool  active;
   bool  assigned;
   index trackId;
+
+  void push(const SinePeak& peak)
+  {
+    peaks[asUnsigned(length++ % asSigned(peaks.size()))] = peak;
+  }
+
+  const SinePeak& back() const
+  {
+    return peaks[asUnsigned((length - 1) % asSigned(peaks.size()))];
+  }
+
+  // whether the peak for frame is still in the ring
+  bool has(index frame) const
+  {
+    index i = frame - startFrame;
+    return i >= 0 && i < length && length - i <= asSigned(peaks.size());
+  }
+
+  const SinePeak& at(index frame) const
+  {
+    assert(has(frame));
+    return peaks[asUnsigned((frame - startFrame) % asSigned(peaks.size()))];
+  }
+
+  // keeps the newest peaks that still fit
+  void resize(index capacity)
+  {
+    std::vector<SinePeak> resized(asUnsigned(capacity));
+    index                 oldCapacity = asSigned(peaks.size());
+    for (index i = std::max(length - std::min(capacity, oldCapacity), index(0));
+         i < length; i++)
+      resized[asUnsigned(i % capacity)] = peaks[asUnsigned(i % oldCapacity)];
+    peaks.swap(resized);
+  }
 };
 
+/**
+ Tracks sinusoidal peaks from frame to frame.
+
+ Tracks only need their peaks from the last minTrackLength frames, so each
+ keeps them in a fixed ring. Tracks come from a pool and go back to it when
+ pruned, along with their rings, so once the pool has grown to the number of
+ simultaneous tracks a stream needs, frames are processed without allocating.
+ **/
 class PartialTracking
 {
   using ArrayXd = Eigen::ArrayXd;
@@ -51,12 +100,12 @@ class PartialTracking
 public:
   void init()
   {
-    using namespace std;
-
     mCurrentFrame = 0;
-    mTracks = vector<SineTrack>();
-    mPrevPeaks = vector<SinePeak>();
-    mPrevTracks =  vector<index>();
+    for (index t : mTracks) mFreeTracks.push_back(t);
+    mTracks.clear();
+    mPeaks.clear();
+    mPrevPeaks.clear();
+    mPrevTracks.clear();
     mZetaA = 0;
     mZetaF = 0;
     mDelta = 0;
@@ -67,12 +116,17 @@ public:
 
   index minTrackLength() { return mMinTrackLength; }
 
-  void processFrame(vector<SinePeak> peaks, double maxAmp, index minTrackLength,
-                    double birthLowThreshold, double birthHighThreshold,
-                    index method, double zetaA, double zetaF, double delta)
+  void processFrame(const vector<SinePeak>& peaks, double maxAmp,
+                    index minTrackLength, double birthLowThreshold,
+                    double birthHighThreshold, index method, double zetaA,
+                    double zetaF, double delta)
   {
     assert(mInitialized);
-    mMinTrackLength = minTrackLength;
+    if (minTrackLength != mMinTrackLength)
+    {
+      mMinTrackLength = minTrackLength;
+      resizeTracks();
+    }
     mBirthLowThreshold = birthLowThreshold;
     mBirthHighThreshold = birthHighThreshold;
     mBirthRange = mBirthLowThreshold - mBirthHighThreshold;
@@ -83,40 +137,47 @@ public:
       mDelta = delta;
       updateVariances();
     }
+    mPeaks.assign(peaks.begin(), peaks.end());
     if (method == 0)
-      assignGreedy(peaks, maxAmp);
+      assignGreedy(maxAmp);
     else
-      assignMunkres(peaks, maxAmp);
+      assignHungarian(maxAmp);
     mCurrentFrame++;
   }
 
   void prune()
   {
     auto iterator =
-        std::remove_if(mTracks.begin(), mTracks.end(), [&](SineTrack track) {
-          return (track.endFrame >= 0 &&
-                  track.endFrame <= mCurrentFrame - mMinTrackLength);
+        std::remove_if(mTracks.begin(), mTracks.end(), [&](index t) {
+          const SineTrack& track = mTrackPool[asUnsigned(t)];
+          bool             dead = track.endFrame >= 0 &&
+                      track.endFrame <= mCurrentFrame - mMinTrackLength;
+          if (dead) mFreeTracks.push_back(t);
+          return dead;
         });
     mTracks.erase(iterator, mTracks.end());
   }
 
-
-  vector<SinePeak> getActivePeaks()
+  // The peaks of tracks alive minTrackLength frames ago; valid until the next
+  // call
+  const vector<SinePeak>& getActivePeaks()
   {
-    vector<SinePeak> sinePeaks;
-    index            latencyFrame = mCurrentFrame - mMinTrackLength;
-    if (latencyFrame < 0) return sinePeaks;
-    for (auto&& track : mTracks)
+    mActivePeaks.clear();
+    index latencyFrame = mCurrentFrame - mMinTrackLength;
+    if (latencyFrame < 0) return mActivePeaks;
+    for (index t : mTracks)
     {
+      const SineTrack& track = mTrackPool[asUnsigned(t)];
       if (track.startFrame > latencyFrame) continue;
       if (track.endFrame >= 0 && track.endFrame <= latencyFrame) continue;
       if (track.endFrame >= 0 &&
           track.endFrame - track.startFrame < mMinTrackLength)
         continue;
-      sinePeaks.push_back(
-          track.peaks[asUnsigned(latencyFrame - track.startFrame)]);
+      // only missing for a while after minTrackLength grows
+      if (!track.has(latencyFrame)) continue;
+      mActivePeaks.push_back(track.at(latencyFrame));
     }
-    return sinePeaks;
+    return mActivePeaks;
   }
 
 private:
@@ -125,123 +186,187 @@ private:
     using namespace std;
     mVarA = -pow(mZetaA, 2) * log((mDelta - 1) / (mDelta - 2));
     mVarF = -pow(mZetaF, 2) * log((mDelta - 1) / (mDelta - 2));
+    // a pair is only useful while deltaF^2 / mVarF + deltaA^2 / mVarA is below
+    // mVarF / mZetaF^2, which bounds deltaF by this
+    mFreqGate = mVarF / mZetaF;
   }
 
-  void assignMunkres(vector<SinePeak> sinePeaks, double maxAmp)
+  // peaks are read back at most minTrackLength frames after the newest
+  index trackCapacity() const { return mMinTrackLength + 1; }
+
+  void resizeTracks()
   {
-    using namespace Eigen;
-    using namespace std;
+    for (auto& track : mTrackPool) track.resize(trackCapacity());
+  }
+
+  index newTrack(index startFrame, index trackId)
+  {
+    index t;
+    if (mFreeTracks.empty())
+    {
+      t = asSigned(mTrackPool.size());
+      mTrackPool.emplace_back();
+      mTrackPool.back().peaks.resize(asUnsigned(trackCapacity()));
+    }
+    else
+    {
+      t = mFreeTracks.back();
+      mFreeTracks.pop_back();
+    }
+    SineTrack& track = mTrackPool[asUnsigned(t)];
+    track.startFrame = startFrame;
+    track.endFrame = -1;
+    track.length = 0;
+    track.active = true;
+    track.assigned = true;
+    track.trackId = trackId;
+    mTracks.push_back(t);
+    return t;
+  }
 
-    typedef Array<bool, Dynamic, Dynamic> ArrayXXb;
-    for (auto&& track : mTracks) { track.assigned = false; }
+  // Cost of continuing from a previous peak to a current one, as whichever
+  // of the useful and spurious costs is smaller, and whether it is useful
+  std::pair<double, bool> pairCost(const SinePeak& prev, const SinePeak& peak)
+  {
+    double deltaF = prev.freq - peak.freq;
+    double deltaA = prev.logMag - peak.logMag;
+    double usefulCost =
+        1 - std::exp(-deltaF * deltaF / mVarF - deltaA * deltaA / mVarA);
+    double spuriousCost = 1 - (1 - mDelta) * usefulCost;
+    if (usefulCost < spuriousCost)
+      return {std::abs(usefulCost), true};
+    else
+      return {spuriousCost, false};
+  }
+
+  void assignHungarian(double maxAmp)
+  {
+    vector<SinePeak>& sinePeaks = mPeaks;
+    for (index t : mTracks) mTrackPool[asUnsigned(t)].assigned = false;
 
     if (mPrevPeaks.empty())
     {
-      mPrevPeaks = sinePeaks;
-      mPrevTracks = vector<index>(sinePeaks.size(), 0);
+      mPrevPeaks.assign(sinePeaks.begin(), sinePeaks.end());
+      mPrevTracks.assign(sinePeaks.size(), -1);
       return;
     }
 
-    index         N = asSigned(mPrevPeaks.size());
-    index         M = asSigned(sinePeaks.size());
-    ArrayXd       peakFreqs(M);
-    ArrayXd       peakAmps(M);
-    ArrayXd       prevFreqs(N);
-    ArrayXd       prevAmps(N);
-    vector<index> trackAssignment(asUnsigned(M), -1);
+    index          N = asSigned(mPrevPeaks.size());
+    index          M = asSigned(sinePeaks.size());
+    vector<index>& trackAssignment = mTrackAssignment;
+    trackAssignment.assign(asUnsigned(M), -1);
     if (sinePeaks.size() > 0)
     {
-      for (index i = 0; i < M; i++)
-      {
-        peakFreqs(i) = sinePeaks[asUnsigned(i)].freq;
-        peakAmps(i) = sinePeaks[asUnsigned(i)].logMag;
-      }
-      for (index i = 0; i < N; i++)
-      {
-        prevFreqs(i) = mPrevPeaks[asUnsigned(i)].freq;
-        prevAmps(i) = mPrevPeaks[asUnsigned(i)].logMag;
-      }
-      ArrayXXd deltaF = ArrayXXd::Zero(N, M);
-      deltaF.colwise() = prevFreqs;
-      for (index i = 0; i < N; i++) { deltaF.row(i) -= peakFreqs; }
-      ArrayXXd deltaA = ArrayXXd::Zero(N, M);
-      deltaA.colwise() = prevAmps;
-      for (index i = 0; i < N; i++) { deltaA.row(i) -= peakAmps; }
-
-      ArrayXXd usefulCost =
-          1 - (-deltaF.square() / mVarF - deltaA.square() / mVarA).exp();
-      ArrayXXd spuriousCost = 1 - (1 - mDelta) * usefulCost;
-      ArrayXXd cost(N, M);
-      ArrayXXb useful(N, M);
-      for (index i = 0; i < N; i++)
-      {
-        for (index j = 0; j < M; j++)
-        {
-          if (usefulCost(i, j) < spuriousCost(i, j))
-          {
-            cost(i, j) = std::abs(usefulCost(i, j));
-            useful(i, j) = true;
-          }
-          else
-          {
-            cost(i, j) = spuriousCost(i, j);
-            useful(i, j) = false;
-          }
-        }
-      }
-      ArrayXi assignment(N);
-      mMunkres.init(N, M);
-      mMunkres.process(cost, assignment);
+      mAssignmentResult.resize(N);
+      if (mFreqGate < std::numeric_limits<double>::infinity())
+        solveGated(N, M);
+      else
+        solveDense(N, M);
       for (index i = 0; i < N; i++)
       {
-        index p = assignment(i);
+        index p = mAssignmentResult(i);
         bool  aboveBirthThreshold =
             mPrevPeaks[asUnsigned(i)].logMag >
             birthThreshold(mPrevPeaks[asUnsigned(i)], mPrevMaxAmp);
-        if (assignment(i) >= useful.cols()) continue;
-        if (useful(i, assignment(i)) && mPrevTracks[asUnsigned(i)] > 0 &&
+        if (p < 0) continue;
+        bool useful =
+            pairCost(mPrevPeaks[asUnsigned(i)], sinePeaks[asUnsigned(p)])
+                .second;
+        // a previous peak that continued a track was assigned to it in the
+        // frame before, so the track is still in mTracks
+        if (useful && mPrevTracks[asUnsigned(i)] >= 0 &&
             mPrevPeaks[asUnsigned(i)].assigned)
         {
-          for (auto& t : mTracks)
-          {
-            if (t.trackId == mPrevTracks[asUnsigned(i)])
-            {
-              trackAssignment[asUnsigned(p)] = t.trackId;
-              sinePeaks[asUnsigned(p)].assigned = true;
-              t.assigned = true;
-              t.peaks.push_back(sinePeaks[asUnsigned(p)]);
-            }
-          }
+          SineTrack& t = mTrackPool[asUnsigned(mPrevTracks[asUnsigned(i)])];
+          trackAssignment[asUnsigned(p)] = mPrevTracks[asUnsigned(i)];
+          sinePeaks[asUnsigned(p)].assigned = true;
+          t.assigned = true;
+          t.push(sinePeaks[asUnsigned(p)]);
         }
-        else if (aboveBirthThreshold && useful(i, assignment(i)) &&
+        else if (aboveBirthThreshold && useful &&
                  !mPrevPeaks[asUnsigned(i)].assigned)
         {
           mLastTrackId = mLastTrackId + 1;
-          auto newTrack = SineTrack{vector<SinePeak>{mPrevPeaks[asUnsigned(i)],
-                                                     sinePeaks[asUnsigned(p)]},
-                                    mCurrentFrame - 1,
-                                    -1,
-                                    true,
-                                    true,
-                                    mLastTrackId};
-          mTracks.push_back(newTrack);
+          index      t = newTrack(mCurrentFrame - 1, mLastTrackId);
+          SineTrack& track = mTrackPool[asUnsigned(t)];
+          track.push(mPrevPeaks[asUnsigned(i)]);
+          track.push(sinePeaks[asUnsigned(p)]);
           sinePeaks[asUnsigned(p)].assigned = true;
-          trackAssignment[asUnsigned(p)] = newTrack.trackId;
+          trackAssignment[asUnsigned(p)] = t;
         }
       }
     }
-    // diying tracks
-    for (auto&& track : mTracks)
+    killUnassigned();
+    mPrevTracks.swap(trackAssignment);
+    mPrevPeaks.swap(sinePeaks);
+    mPrevMaxAmp = maxAmp;
+  }
+
+  // Only pairs closer in frequency than mFreqGate can ever be useful, so only
+  // they are offered to the solver. Peaks are walked in frequency order so
+  // each previous peak meets just the current peaks in range.
+  void solveGated(index N, index M)
+  {
+    const vector<SinePeak>& sinePeaks = mPeaks;
+    sortByFrequency(mPrevOrder, mPrevPeaks);
+    sortByFrequency(mPeakOrder, sinePeaks);
+    mAssignment.init(N, M);
+    index first = 0;
+    for (index i : mPrevOrder)
     {
+      const SinePeak& prev = mPrevPeaks[asUnsigned(i)];
+      while (first < M &&
+             sinePeaks[asUnsigned(mPeakOrder[asUnsigned(first)])].freq <
+                 prev.freq - mFreqGate)
+        first++;
+      for (index k = first; k < M; k++)
+      {
+        index           j = mPeakOrder[asUnsigned(k)];
+        const SinePeak& peak = sinePeaks[asUnsigned(j)];
+        if (peak.freq > prev.freq + mFreqGate) break;
+        mAssignment.addEdge(i, j, pairCost(prev, peak).first);
+      }
+    }
+    // Leaving a previous peak unmatched costs what pairing it with a peak
+    // infinitely far away would, as the spurious cost tends to mDelta
+    mAssignment.process(mDelta, mAssignmentResult);
+  }
+
+  // With mDelta at 1 every pair is useful at no cost, so there is nothing to
+  // gate and the dense problem is solved directly
+  void solveDense(index N, index M)
+  {
+    mCost.resize(N, M);
+    for (index i = 0; i < N; i++)
+      for (index j = 0; j < M; j++)
+        mCost(i, j) =
+            pairCost(mPrevPeaks[asUnsigned(i)], mPeaks[asUnsigned(j)]).first;
+    mMunkres.init(N, M);
+    mMunkres.process(mCost, mAssignmentResult);
+    for (index i = 0; i < N; i++)
+      if (mAssignmentResult(i) >= M) mAssignmentResult(i) = -1;
+  }
+
+  void sortByFrequency(vector<index>& order, const vector<SinePeak>& peaks)
+  {
+    order.resize(peaks.size());
+    for (index i = 0; i < asSigned(order.size()); i++) order[asUnsigned(i)] = i;
+    std::sort(order.begin(), order.end(), [&peaks](index a, index b) {
+      return peaks[asUnsigned(a)].freq < peaks[asUnsigned(b)].freq;
+    });
+  }
+
+  void killUnassigned()
+  {
+    for (index t : mTracks)
+    {
+      SineTrack& track = mTrackPool[asUnsigned(t)];
       if (track.active && !track.assigned)
       {
         track.active = false;
         track.endFrame = mCurrentFrame;
       }
     }
-    mPrevTracks = trackAssignment;
-    mPrevPeaks = sinePeaks;
-    mPrevMaxAmp = maxAmp;
   }
 
   double birthThreshold(SinePeak peak, double maxAmp)
@@ -250,77 +375,87 @@ private:
            mBirthRange * std::pow(0.0075, peak.freq / 20000.0);
   }
 
-  void assignGreedy(vector<SinePeak> sinePeaks, double maxAmp)
+  void assignGreedy(double maxAmp)
   {
     using namespace std;
-    vector<tuple<double, SineTrack*, SinePeak*>> distances;
-    for (auto&& track : mTracks) { track.assigned = false; }
-    for (auto& track : mTracks)
+    vector<SinePeak>& sinePeaks = mPeaks;
+    mDistances.clear();
+    // Hungarian matching refers to tracks by pool slot, which may be reused
+    // by the time it runs again, so it starts afresh after greedy frames
+    mPrevPeaks.clear();
+    for (index t : mTracks) mTrackPool[asUnsigned(t)].assigned = false;
+    for (index t : mTracks)
     {
+      const SineTrack& track = mTrackPool[asUnsigned(t)];
       if (track.active)
       {
-        for (auto&& peak : sinePeaks)
+        const SinePeak& last = track.back();
+        for (index p = 0; p < asSigned(sinePeaks.size()); p++)
         {
-          double dist =
-              1 - exp(-pow(track.peaks.back().freq - peak.freq, 2) / mVarF -
-                      pow(track.peaks.back().logMag - peak.logMag, 2) / mVarA);
-          distances.push_back(std::make_tuple(dist, &track, &peak));
+          const SinePeak& peak = sinePeaks[asUnsigned(p)];
+          double          dist =
+              1 - exp(-pow(last.freq - peak.freq, 2) / mVarF -
+                      pow(last.logMag - peak.logMag, 2) / mVarA);
+          mDistances.emplace_back(dist, t, p);
         }
       }
     }
 
-    sort(distances.begin(), distances.end(),
-         [](tuple<double, SineTrack*, SinePeak*> const& t1,
-            tuple<double, SineTrack*, SinePeak*> const& t2) {
+    sort(mDistances.begin(), mDistances.end(),
+         [](Distance const& t1, Distance const& t2) {
            return get<0>(t1) < get<0>(t2);
          });
 
-    for (auto&& pairing : distances)
+    for (auto&& pairing : mDistances)
     {
-      if (!get<1>(pairing)->assigned && !get<2>(pairing)->assigned &&
+      SineTrack& track = mTrackPool[asUnsigned(get<1>(pairing))];
+      SinePeak&  peak = sinePeaks[asUnsigned(get<2>(pairing))];
+      if (!track.assigned && !peak.assigned &&
           get<0>(pairing) <
               (1 - (1 - mDelta) * get<0>(pairing))) // useful vs spurious
       {
-        get<1>(pairing)->peaks.push_back(*get<2>(pairing));
-        get<1>(pairing)->assigned = true;
-        get<2>(pairing)->assigned = true;
+        track.push(peak);
+        track.assigned = true;
+        peak.assigned = true;
       }
     }
     // new tracks
-    index nBorn = 0, nDead = 0;
     for (auto&& peak : sinePeaks)
     {
       if (!peak.assigned && peak.logMag > birthThreshold(peak, maxAmp))
       {
-        nBorn++;
-        mTracks.push_back(SineTrack{vector<SinePeak>{peak},
-                                    static_cast<int>(mCurrentFrame), -1, true,
-                                    true, mLastTrackId++});
-      }
-    }
-    // diying tracks
-    for (auto&& track : mTracks)
-    {
-      if (track.active && !track.assigned)
-      {
-        nDead++;
-        track.active = false;
-        track.endFrame = mCurrentFrame;
+        index t = newTrack(mCurrentFrame, mLastTrackId++);
+        mTrackPool[asUnsigned(t)].push(peak);
       }
     }
+    killUnassigned();
   }
 
+  using Distance = std::tuple<double, index, index>;
+
   index             mMinTrackLength{15};
   index             mCurrentFrame{0};
-  vector<SineTrack> mTracks;
+  vector<SineTrack> mTrackPool;
+  vector<index>     mTracks;     // live tracks in the pool, oldest first
+  vector<index>     mFreeTracks; // pruned tracks, ready for reuse
   bool              mInitialized{false};
+  vector<SinePeak>  mPeaks;
   vector<SinePeak>  mPrevPeaks;
-  vector<index>     mPrevTracks;
+  vector<index>     mPrevTracks; // track continued by each previous peak
+  vector<index>     mTrackAssignment;
+  vector<SinePeak>  mActivePeaks;
+  vector<Distance>  mDistances;
+  SparseAssignment  mAssignment;
   Munkres           mMunkres;
+  Eigen::ArrayXXd   mCost;
+  Eigen::ArrayXi    mAssignmentResult;
+  vector<index>     mPrevOrder;
+  vector<index>     mPeakOrder;
   double            mZetaA{0};
   double            mVarA{0};
   double            mZetaF{0};
   double            mVarF{0};
+  double            mFreqGate{0};
   double            mDelta{0};
   double            mPrevMaxAmp{0};
   index             mLastTrackId{1};
@@ -29,8 +29,18 @@ public:
                        double minHeight = 0, bool interpolate = true,
                        bool sort = true)
   {
-    using std::make_pair;
     pairs_vector peaks;
+    process(input, peaks, numPeaks, minHeight, interpolate, sort);
+    return peaks;
+  }
+
+  // as above, but reusing the storage of peaks
+  void process(const Eigen::Ref<ArrayXd>& input, pairs_vector& peaks,
+               index numPeaks = 0, double minHeight = 0,
+               bool interpolate = true, bool sort = true)
+  {
+    using std::make_pair;
+    peaks.clear();
 
     for (index i = 1; i < input.size() - 1; i++)
     {
@@ -59,10 +69,8 @@ public:
         return left.second > right.second;
       });
     }
-    if (numPeaks > 0 && peaks.size() > 0)
-    { return pairs_vector(peaks.begin(), peaks.begin() + numPeaks); }
-    else
-      return peaks;
+    if (numPeaks > 0 && asSigned(peaks.size()) > numPeaks)
+      peaks.resize(asUnsigned(numPeaks));
   }
 };
 } // namespace algorithm
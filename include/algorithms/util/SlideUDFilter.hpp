@@ -28,14 +28,11 @@ public:
 
   double processSample(double x)
   {
-    double y;
-    if (x > y0) { y = y0 + (mBUp * (x - y0)); }
-    else
-    {
-      y = y0 + (mBDown * (x - y0));
-    }
-    y0 = y;
-    return y;
+    // select the coefficient rather than branch: on noisy input the
+    // direction is unpredictable
+    double b = x > y0 ? mBUp : mBDown;
+    y0 = y0 + (b * (x - y0));
+    return y0;
   }
 
 private:
@@ -0,0 +1,216 @@
+/*
+Part of the Fluid Corpus Manipulation Project (http://www.flucoma.org/)
+Copyright 2017-2019 University of Huddersfield.
+Licensed under the BSD-3 License.
+See license.md file in the project root for full license information.
+This project has received funding from the European Research Council (ERC)
+under the European Union’s Horizon 2020 research and innovation programme
+(grant agreement No 725899).
+*/
+#pragma once
+
+#include "../../data/FluidIndex.hpp"
+#include <Eigen/Core>
+#include <algorithm>
+#include <cassert>
+#include <functional>
+#include <limits>
+#include <utility>
+#include <vector>
+
+namespace fluid {
+namespace algorithm {
+
+/**
+ Minimum cost assignment of rows to columns over a sparse set of allowed
+ pairs, where a row may also be left unassigned at a fixed cost.
+
+ Rows are added one at a time by successive shortest augmenting paths
+ (Dijkstra with dual potentials), so each search only visits the connected
+ component of the graph its row belongs to: independent groups of rows and
+ columns are solved independently, at a cost that depends on the number of
+ allowed pairs rather than on rows x columns. Working storage is kept between
+ calls.
+ **/
+class SparseAssignment
+{
+public:
+  void init(index rows, index cols)
+  {
+    assert(rows >= 0 && cols >= 0);
+    mRows = rows;
+    mCols = cols;
+    mEdges.clear();
+  }
+
+  // allows row to be assigned to col, at a non-negative cost
+  void addEdge(index row, index col, double cost)
+  {
+    assert(row >= 0 && row < mRows && col >= 0 && col < mCols && cost >= 0);
+    mEdges.push_back({row, col, cost});
+  }
+
+  // result(i) is the column assigned to row i, or -1 if it is unassigned
+  void process(double unassignedCost, Eigen::Ref<Eigen::ArrayXi> result)
+  {
+    assert(result.size() == mRows && unassignedCost >= 0);
+    mUnassignedCost = unassignedCost;
+    buildAdjacency();
+
+    // each row has a private column beyond the real ones for being unassigned
+    index nCols = mCols + mRows;
+    mRowPotential.assign(asUnsigned(mRows), 0);
+    mColPotential.assign(asUnsigned(nCols), 0);
+    mRowMatch.assign(asUnsigned(mRows), -1);
+    mColMatch.assign(asUnsigned(nCols), -1);
+    mDistance.assign(asUnsigned(nCols), infinity());
+    mPredecessor.assign(asUnsigned(nCols), -1);
+    mScanned.assign(asUnsigned(nCols), false);
+
+    for (index row = 0; row < mRows; row++) augment(row);
+
+    for (index i = 0; i < mRows; i++)
+    {
+      index col = mRowMatch[asUnsigned(i)];
+      result(i) = static_cast<int>(col < mCols ? col : -1);
+    }
+  }
+
+private:
+  struct Edge
+  {
+    index  row;
+    index  col;
+    double cost;
+  };
+
+  struct Arc
+  {
+    index  col;
+    double cost;
+  };
+
+  using HeapEntry = std::pair<double, index>;
+
+  static double infinity() { return std::numeric_limits<double>::infinity(); }
+
+  // edges grouped by row (counting sort, keeping their order within a row)
+  void buildAdjacency()
+  {
+    mRowStart.assign(asUnsigned(mRows + 1), 0);
+    for (auto& e : mEdges) mRowStart[asUnsigned(e.row + 1)]++;
+    for (index i = 0; i < mRows; i++)
+      mRowStart[asUnsigned(i + 1)] += mRowStart[asUnsigned(i)];
+    mArcs.resize(mEdges.size());
+    mFill.assign(mRowStart.begin(), mRowStart.end() - 1);
+    for (auto& e : mEdges)
+      mArcs[asUnsigned(mFill[asUnsigned(e.row)]++)] = {e.col, e.cost};
+  }
+
+  void relax(index row, double rowDistance, index col, double cost)
+  {
+    if (mScanned[asUnsigned(col)]) return;
+    double d = rowDistance + cost - mRowPotential[asUnsigned(row)] -
+               mColPotential[asUnsigned(col)];
+    if (d < mDistance[asUnsigned(col)])
+    {
+      if (mDistance[asUnsigned(col)] == infinity()) mTouched.push_back(col);
+      mDistance[asUnsigned(col)] = d;
+      mPredecessor[asUnsigned(col)] = row;
+      mHeap.emplace_back(d, col);
+      std::push_heap(mHeap.begin(), mHeap.end(), std::greater<HeapEntry>());
+    }
+  }
+
+  void expand(index row, double rowDistance)
+  {
+    for (index a = mRowStart[asUnsigned(row)],
+               end = mRowStart[asUnsigned(row + 1)];
+         a < end; a++)
+      relax(row, rowDistance, mArcs[asUnsigned(a)].col,
+            mArcs[asUnsigned(a)].cost);
+    relax(row, rowDistance, mCols + row, mUnassignedCost);
+  }
+
+  // shortest augmenting path from an unassigned row to a free column in
+  // reduced costs; the row's own unassigned column guarantees one exists
+  void augment(index start)
+  {
+    mHeap.clear();
+    mTouched.clear();
+    mFinished.clear();
+
+    expand(start, 0);
+
+    index sink = -1;
+    while (!mHeap.empty())
+    {
+      std::pop_heap(mHeap.begin(), mHeap.end(), std::greater<HeapEntry>());
+      HeapEntry top = mHeap.back();
+      mHeap.pop_back();
+      index col = top.second;
+      if (mScanned[asUnsigned(col)] || top.first > mDistance[asUnsigned(col)])
+        continue;
+      mScanned[asUnsigned(col)] = true;
+      mFinished.push_back(col);
+      index row = mColMatch[asUnsigned(col)];
+      if (row < 0)
+      {
+        sink = col;
+        break;
+      }
+      expand(row, top.first);
+    }
+    assert(sink >= 0);
+
+    // update potentials so every pair stays non-negative in reduced cost, and
+    // the path just found is tight
+    double length = mDistance[asUnsigned(sink)];
+    mRowPotential[asUnsigned(start)] += length;
+    for (index col : mFinished)
+    {
+      if (col == sink) continue;
+      double slack = length - mDistance[asUnsigned(col)];
+      mColPotential[asUnsigned(col)] -= slack;
+      mRowPotential[asUnsigned(mColMatch[asUnsigned(col)])] += slack;
+    }
+
+    for (index col = sink;;)
+    {
+      index row = mPredecessor[asUnsigned(col)];
+      index next = mRowMatch[asUnsigned(row)];
+      mRowMatch[asUnsigned(row)] = col;
+      mColMatch[asUnsigned(col)] = row;
+      if (row == start) break;
+      col = next;
+    }
+
+    for (index col : mTouched)
+    {
+      mDistance[asUnsigned(col)] = infinity();
+      mScanned[asUnsigned(col)] = false;
+    }
+  }
+
+  index  mRows{0};
+  index  mCols{0};
+  double mUnassignedCost{1};
+
+  std::vector<Edge>      mEdges;
+  std::vector<index>     mRowStart;
+  std::vector<index>     mFill;
+  std::vector<Arc>       mArcs;
+  std::vector<double>    mRowPotential;
+  std::vector<double>    mColPotential;
+  std::vector<index>     mRowMatch;
+  std::vector<index>     mColMatch;
+  std::vector<double>    mDistance;
+  std::vector<index>     mPredecessor;
+  std::vector<bool>      mScanned;
+  std::vector<index>     mTouched;
+  std::vector<index>     mFinished;
+  std::vector<HeapEntry> mHeap;
+};
+
+} // namespace algorithm
+} // namespace fluid
@@ -9,60 +9,155 @@ under the European Union’s Horizon 2020 research and innovation programme
 */
 #pragma once
 
-#include "../util/FFT.hpp"
+#include "../util/AlgorithmUtils.hpp"
 #include "../util/FluidEigenMappings.hpp"
 #include "../../data/FluidIndex.hpp"
 #include "../../data/TensorTypes.hpp"
-#include <Eigen/Eigen>
+#include <Eigen/Core>
+#include <algorithm>
+#include <cassert>
 #include <cmath>
 
 namespace fluid {
 namespace algorithm {
 
+/**
+ True peak over a sliding window, following the approach of ITU-R BS.1770:
+ the input is oversampled (4x below 96kHz, 2x below 192kHz) by a polyphase
+ windowed-sinc FIR, and the largest absolute value is taken.
+
+ The filter carries its state from one frame to the next, so when frames
+ overlap only the hopSize samples not seen before are filtered. Each phase
+ is a few vectorised multiply-adds over those samples, and a monotonic queue
+ of per-sample peaks gives the maximum over the window, so the cost per
+ frame follows the hop rather than the window size.
+ **/
 class TruePeak
 {
-
-  using ArrayXcd = Eigen::ArrayXcd;
+  using ArrayXd = Eigen::ArrayXd;
+  using ArrayXXd = Eigen::ArrayXXd;
+  using ArrayXi = Eigen::Array<index, Eigen::Dynamic, 1>;
 
 public:
-  TruePeak(index maxSize) : mFFT(maxSize), mIFFT(maxSize * 4) {}
+  TruePeak(index maxSize)
+      : mHistory(maxSize + kTaps - 1), mOversampled(maxSize), mPeaks(maxSize),
+        mQueueIndex(maxSize + 1), mQueueValue(maxSize + 1),
+        mMaxSize(maxSize)
+  {}
+
+  void init(index size, index hopSize, double sampleRate)
+  {
+    assert(size <= mMaxSize && hopSize > 0);
+    mSize = size;
+    mHopSize = hopSize;
+    mFactor = sampleRate < 96000 ? 4 : sampleRate < 192000 ? 2 : 1;
+    makeFilter();
+    reset();
+  }
 
-  void init(index size, double sampleRate)
+  // forgets the previous frame, so the next one is processed in full
+  void reset()
   {
-    using namespace std;
-    mSampleRate = sampleRate;
-    mFFTSize = static_cast<index>(pow(2, ceil(log(size) / log(2))));
-    mFactor = sampleRate < 96000 ? 4 : 2;
-    mFFT.resize(mFFTSize);
-    mIFFT.resize(mFFTSize * mFactor);
-    mBuffer = ArrayXcd::Zero((mFFTSize * mFactor / 2) + 1);
+    mHistory.setZero();
+    mSampleCount = 0;
+    mQueueStart = 0;
+    mQueueSize = 0;
+    mPrimed = false;
   }
 
   double processFrame(const RealVectorView& input)
   {
     using namespace Eigen;
-    ArrayXd in = _impl::asEigen<Array>(input);
-    if (mSampleRate >= 192000) { return in.abs().maxCoeff(); }
+    assert(input.size() == mSize);
+    auto in = _impl::asEigen<Array>(input).col(0);
+    // frames that don't overlap the last one start from silence
+    if (mPrimed && mHopSize > mSize) reset();
+    index n = mPrimed ? mHopSize : mSize;
+    process(in.tail(n));
+    mPrimed = true;
+    return mQueueValue(mQueueStart);
+  }
+
+private:
+  static constexpr index kTaps = 12; // per phase
+
+  // Hann-windowed sinc at the input's Nyquist frequency, with phase p of
+  // each output sample in column p
+  void makeFilter()
+  {
+    mFilter.resize(kTaps, mFactor);
+    if (mFactor == 1) return;
+    index  length = kTaps * mFactor;
+    double centre = (length - 1) / 2.0;
+    for (index i = 0; i < length; i++)
+    {
+      double x = pi * (i - centre) / mFactor;
+      double window = 0.5 - 0.5 * std::cos(twoPi * (i + 1) / (length + 1));
+      mFilter(i / mFactor, i % mFactor) = window * std::sin(x) / x;
+    }
+    mFilter *= mFactor / mFilter.sum();
+  }
+
+  template <typename Input>
+  void process(const Input& input)
+  {
+    index n = input.size();
+    auto  peaks = mPeaks.head(n);
+    if (mFactor == 1)
+      peaks = input.abs();
     else
     {
-      double   peak;
-      ArrayXcd transform = mFFT.process(in);
-      mBuffer.setZero();
-      mBuffer.segment(0, transform.size()) = transform;
-      ArrayXd result = mIFFT.process(mBuffer);
-      ArrayXd scaled = result / mFFTSize;
-      peak = scaled.abs().maxCoeff();
-      return peak;
+      mHistory.segment(kTaps - 1, n) = input;
+      auto y = mOversampled.head(n);
+      for (index p = 0; p < mFactor; p++)
+      {
+        y = mFilter(0, p) * mHistory.segment(kTaps - 1, n);
+        for (index j = 1; j < kTaps; j++)
+          y += mFilter(j, p) * mHistory.segment(kTaps - 1 - j, n);
+        if (p)
+          peaks = peaks.max(y.abs());
+        else
+          peaks = y.abs();
+      }
+      std::copy(mHistory.data() + n, mHistory.data() + n + kTaps - 1,
+                mHistory.data());
     }
+    for (index i = 0; i < n; i++) push(peaks(i));
   }
 
-private:
-  FFT      mFFT;
-  IFFT     mIFFT;
-  ArrayXcd mBuffer;
-  double   mSampleRate{44100.0};
+  // keeps the decreasing run of peaks in the last mSize samples, so the
+  // front of the queue is the window's maximum
+  void push(double peak)
+  {
+    index capacity = mQueueIndex.size();
+    while (mQueueSize > 0 &&
+           mQueueValue((mQueueStart + mQueueSize - 1) % capacity) <= peak)
+      mQueueSize--;
+    index back = (mQueueStart + mQueueSize++) % capacity;
+    mQueueIndex(back) = mSampleCount;
+    mQueueValue(back) = peak;
+    if (mQueueIndex(mQueueStart) <= mSampleCount - mSize)
+    {
+      mQueueStart = (mQueueStart + 1) % capacity;
+      mQueueSize--;
+    }
+    mSampleCount++;
+  }
+
+  ArrayXXd mFilter;
+  ArrayXd  mHistory; // kTaps - 1 previous samples, then the new ones
+  ArrayXd  mOversampled;
+  ArrayXd  mPeaks;
+  ArrayXi  mQueueIndex;
+  ArrayXd  mQueueValue;
+  index    mQueueStart{0};
+  index    mQueueSize{0};
+  index    mSampleCount{0};
+  index    mMaxSize;
+  index    mSize{1024};
+  index    mHopSize{512};
   index    mFactor{4};
-  index    mFFTSize{1024};
+  bool     mPrimed{false};
 };
 } // namespace algorithm
 } // namespace fluid
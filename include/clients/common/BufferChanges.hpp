@@ -0,0 +1,46 @@
+/*
+Part of the Fluid Corpus Manipulation Project (http://www.flucoma.org/)
+Copyright 2017-2019 University of Huddersfield.
+Licensed under the BSD-3 License.
+See license.md file in the project root for full license information.
+This project has received funding from the European Research Council (ERC)
+under the European Union’s Horizon 2020 research and innovation programme
+(grant agreement No 725899).
+*/
+
+#pragma once
+
+#include "BufferAdaptor.hpp"
+#include "../../data/FluidIndex.hpp"
+#include "../../data/FluidTensor.hpp"
+#include <algorithm>
+
+namespace fluid {
+namespace client {
+namespace impl {
+
+/// Copies the first cache.rows() channels of a buffer into cache, and returns
+/// whether any value differed. There is no way to know that the host has
+/// written to a buffer without reading it, so an unchanged buffer still costs
+/// a full comparison every call; what this saves is the caller's rebuild of
+/// whatever it derives from the cached values (e.g. an NMF dictionary).
+inline bool copyIfChanged(BufferAdaptor::ReadAccess& buffer,
+                          FluidTensorView<double, 2> cache)
+{
+  bool changed = false;
+  for (index i = 0; i < cache.rows(); ++i)
+  {
+    auto source = buffer.samps(i);
+    auto cached = cache.row(i);
+    if (!std::equal(cached.begin(), cached.end(), source.begin()))
+    {
+      cached = source;
+      changed = true;
+    }
+  }
+  return changed;
+}
+
+} // namespace impl
+} // namespace client
+} // namespace fluid
@@ -222,8 +222,14 @@ private:
     bool      newParams = mTrackValues.changed(
         fftParams.winSize(), fftParams.hopSize(), fftParams.fftSize());
     index hostBufferSize = input[0].size();
+    index chansIn = mBufferedProcess.channelsIn();
+    index chansOut = mBufferedProcess.channelsOut();
+
     if (mTrackHostVS.changed(hostBufferSize))
+    {
       mBufferedProcess.hostSize(hostBufferSize);
+      if (chansIn > 1) mInput.resize(chansIn, hostBufferSize);
+    }
 
     if (!mSTFT.get() || newParams)
       mSTFT.reset(new algorithm::STFT(fftParams.winSize(), fftParams.fftSize(),
@@ -232,9 +238,6 @@ private:
       mISTFT.reset(new algorithm::ISTFT(
           fftParams.winSize(), fftParams.fftSize(), fftParams.hopSize()));
 
-    index chansIn = mBufferedProcess.channelsIn();
-    index chansOut = mBufferedProcess.channelsOut();
-
     if (fftParams.frameSize() != mSpectrumIn.cols())
       mSpectrumIn.resize(chansIn, fftParams.frameSize());
 
@@ -247,12 +250,21 @@ private:
           chansOut,
           std::max(mBufferedProcess.maxWindowSizeIn(), hostBufferSize));
 
-    mBufferedProcess.push(HostMatrix(input[0]));
+    if (chansIn == 1)
+      mBufferedProcess.push(HostMatrix(input[0]));
+    else
+    {
+      // host channels arrive as separate vectors
+      for (index i = 0; i < chansIn; ++i)
+        mInput.row(i) = input[asUnsigned(i)];
+      mBufferedProcess.push(RealMatrixView(mInput));
+    }
     return fftParams;
   }
 
   ParameterTrackChanges<index, index, index> mTrackValues;
   ParameterTrackChanges<index>               mTrackHostVS;
+  RealMatrix                                 mInput;
   RealMatrix                                 mFrameAndWindow;
   ComplexMatrix                              mSpectrumIn;
   ComplexMatrix                              mSpectrumOut;
@@ -234,66 +234,110 @@ private:
   WrappedClient                            mClient;
 };
 //////////////////////////////////////////////////////////////////////////////////////////////////////
-template <typename HostMatrix, typename HostVectorView>
-struct Streaming
+// Copies each input channel into host memory, with padding frames at the end
+// for latency, hands that channel's rows to processChannel, and writes the
+// outputs back without the padding. processChannel returns false to cancel
+template <typename HostMatrix, typename HostVectorView, typename InputList,
+          typename OutputList, typename F>
+Result processChannels(InputList& inputBuffers, OutputList& outputBuffers,
+                       index nFrames, index nChans, index padding,
+                       FluidContext& c, F&& processChannel)
 {
-  template <typename Client, typename InputList, typename OutputList>
-  static Result process(Client& client, InputList& inputBuffers,
-                        OutputList& outputBuffers, index nFrames, index nChans,
-                        FluidContext& c)
-  {
-    // To account for process latency we need to copy the buffers with padding
-    std::vector<HostMatrix> outputData;
-    std::vector<HostMatrix> inputData;
-
-    outputData.reserve(outputBuffers.size());
-    inputData.reserve(inputBuffers.size());
+  std::vector<HostMatrix> outputData;
+  std::vector<HostMatrix> inputData;
 
-    index padding = client.latency();
+  outputData.reserve(outputBuffers.size());
+  inputData.reserve(inputBuffers.size());
 
-    std::fill_n(std::back_inserter(outputData), outputBuffers.size(),
-                HostMatrix(nChans, nFrames + padding));
-    std::fill_n(std::back_inserter(inputData), inputBuffers.size(),
-                HostMatrix(nChans, nFrames + padding));
+  std::fill_n(std::back_inserter(outputData), outputBuffers.size(),
+              HostMatrix(nChans, nFrames + padding));
+  std::fill_n(std::back_inserter(inputData), inputBuffers.size(),
+              HostMatrix(nChans, nFrames + padding));
 
-    double sampleRate{0};
+  double sampleRate{0};
 
-    for (index i = 0; i < nChans; ++i)
+  for (index i = 0; i < nChans; ++i)
+  {
+    std::vector<HostVectorView> inputs;
+    inputs.reserve(inputBuffers.size());
+    for (index j = 0; j < asSigned(inputBuffers.size()); ++j)
     {
-      std::vector<HostVectorView> inputs;
-      inputs.reserve(inputBuffers.size());
-      for (index j = 0; j < asSigned(inputBuffers.size()); ++j)
-      {
-        BufferAdaptor::ReadAccess thisInput(inputBuffers[asUnsigned(j)].buffer);
-        if (i == 0 && j == 0) sampleRate = thisInput.sampleRate();
-        inputData[asUnsigned(j)].row(i)(Slice(0, nFrames)) =
-            thisInput.samps(inputBuffers[asUnsigned(j)].startFrame, nFrames,
-                            inputBuffers[asUnsigned(j)].startChan + i);
-        inputs.emplace_back(inputData[asUnsigned(j)].row(i));
-      }
+      BufferAdaptor::ReadAccess thisInput(inputBuffers[asUnsigned(j)].buffer);
+      if (i == 0 && j == 0) sampleRate = thisInput.sampleRate();
+      inputData[asUnsigned(j)].row(i)(Slice(0, nFrames)) =
+          thisInput.samps(inputBuffers[asUnsigned(j)].startFrame, nFrames,
+                          inputBuffers[asUnsigned(j)].startChan + i);
+      inputs.emplace_back(inputData[asUnsigned(j)].row(i));
+    }
 
-      std::vector<HostVectorView> outputs;
-      outputs.reserve(outputBuffers.size());
-      for (index j = 0; j < asSigned(outputBuffers.size()); ++j)
-        outputs.emplace_back(outputData[asUnsigned(j)].row(i));
+    std::vector<HostVectorView> outputs;
+    outputs.reserve(outputBuffers.size());
+    for (index j = 0; j < asSigned(outputBuffers.size()); ++j)
+      outputs.emplace_back(outputData[asUnsigned(j)].row(i));
 
-      if (c.task()) c.task()->iterationUpdate(i, nChans);
+    if (c.task()) c.task()->iterationUpdate(i, nChans);
 
-      client.reset();
-      client.process(inputs, outputs, c);
-    }
+    if (!processChannel(inputs, outputs))
+      return {Result::Status::kCancelled, ""};
+  }
 
-    for (index i = 0; i < asSigned(outputBuffers.size()); ++i)
-    {
-      if (!outputBuffers[asUnsigned(i)]) continue;
-      BufferAdaptor::Access thisOutput(outputBuffers[asUnsigned(i)]);
-      Result                r = thisOutput.resize(nFrames, nChans, sampleRate);
-      if (!r.ok()) return r;
-      for (index j = 0; j < nChans; ++j)
-        thisOutput.samps(j) = outputData[asUnsigned(i)].row(j)(Slice(padding));
-    }
+  for (index i = 0; i < asSigned(outputBuffers.size()); ++i)
+  {
+    if (!outputBuffers[asUnsigned(i)]) continue;
+    BufferAdaptor::Access thisOutput(outputBuffers[asUnsigned(i)]);
+    Result                r = thisOutput.resize(nFrames, nChans, sampleRate);
+    if (!r.ok()) return r;
+    for (index j = 0; j < nChans; ++j)
+      thisOutput.samps(j) = outputData[asUnsigned(i)].row(j)(Slice(padding));
+  }
 
-    return {};
+  return {};
+}
+//////////////////////////////////////////////////////////////////////////////////////////////////////
+template <typename HostMatrix, typename HostVectorView>
+struct Streaming
+{
+  template <typename Client, typename InputList, typename OutputList>
+  static Result process(Client& client, InputList& inputBuffers,
+                        OutputList& outputBuffers, index nFrames, index nChans,
+                        FluidContext& c)
+  {
+    // To account for process latency we need to copy the buffers with padding
+    return processChannels<HostMatrix, HostVectorView>(
+        inputBuffers, outputBuffers, nFrames, nChans, client.latency(), c,
+        [&](std::vector<HostVectorView>& inputs,
+            std::vector<HostVectorView>& outputs) {
+          client.reset();
+          client.process(inputs, outputs, c);
+          return true;
+        });
+  }
+};
+//////////////////////////////////////////////////////////////////////////////////////////////////////
+// For clients that can process a whole buffer at once via processOffline(),
+// rather than being streamed through process(): there is no latency to pad for
+// and no state to reset between channels. Clients say through useOffline()
+// whether a buffer of a given length is small enough for that, and are
+// streamed otherwise
+template <typename HostMatrix, typename HostVectorView>
+struct Offline
+{
+  template <typename Client, typename InputList, typename OutputList>
+  static Result process(Client& client, InputList& inputBuffers,
+                        OutputList& outputBuffers, index nFrames, index nChans,
+                        FluidContext& c)
+  {
+    if (!client.useOffline(nFrames))
+      return Streaming<HostMatrix, HostVectorView>::process(
+          client, inputBuffers, outputBuffers, nFrames, nChans, c);
+
+    return processChannels<HostMatrix, HostVectorView>(
+        inputBuffers, outputBuffers, nFrames, nChans, 0, c,
+        [&](std::vector<HostVectorView>& inputs,
+            std::vector<HostVectorView>& outputs) {
+          client.processOffline(inputs, outputs, c);
+          return !(c.task() && c.task()->cancelled());
+        });
   }
 };
 //////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -435,6 +479,10 @@ template <class RTClient, typename Params, Params& PD, index Ins, index Outs>
 using NRTStreamAdaptor =
     impl::NRTClientWrapper<impl::Streaming, RTClient, Params, PD, Ins, Outs>;
 
+template <class RTClient, typename Params, Params& PD, index Ins, index Outs>
+using NRTOfflineAdaptor =
+    impl::NRTClientWrapper<impl::Offline, RTClient, Params, PD, Ins, Outs>;
+
 template <class RTClient, typename Params, Params& PD, index Ins, index Outs>
 using NRTSliceAdaptor =
     impl::NRTClientWrapper<impl::Slicing, RTClient, Params, PD, Ins, Outs>;
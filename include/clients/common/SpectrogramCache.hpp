@@ -0,0 +1,304 @@
+/*
+Part of the Fluid Corpus Manipulation Project (http://www.flucoma.org/)
+Copyright 2017-2019 University of Huddersfield.
+Licensed under the BSD-3 License.
+See license.md file in the project root for full license information.
+This project has received funding from the European Research Council (ERC)
+under the European Union’s Horizon 2020 research and innovation programme
+(grant agreement No 725899).
+*/
+
+#pragma once
+
+#include "ParameterTypes.hpp"
+#include "../../algorithms/public/STFT.hpp"
+#include "../../data/FluidIndex.hpp"
+#include "../../data/TensorTypes.hpp"
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iterator>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include <utility>
+
+namespace fluid {
+namespace client {
+
+/**
+ Process-wide cache of STFTs for NRT clients, so that re-running an analysis
+ over the same audio with the same FFT settings skips the transform.
+
+ Entries are keyed on the content of the analysed samples (two independent
+ 64-bit hashes plus the length) and on the FFT settings. Buffer identity
+ isn't used: threaded NRT processing works on fresh copies of host buffers,
+ so pointers don't survive from one run to the next, whereas the samples do.
+
+ Only the complex spectrum is kept; callers derive magnitudes from it. The
+ budget starts at 0, which disables caching, so nothing is held until a client
+ asks for it (e.g. BufNMF's cacheSize). Least recently used entries are
+ evicted once the budget is exceeded. If a spill directory is set, they are
+ written there instead of being dropped, and are read back on a later miss.
+ Spill files are written and removed outside the lock.
+ **/
+class SpectrogramCache
+{
+public:
+  // shared between callers, so must be treated as read-only
+  using Pointer = std::shared_ptr<ComplexMatrix>;
+
+  static SpectrogramCache& instance()
+  {
+    static SpectrogramCache cache;
+    return cache;
+  }
+
+  SpectrogramCache(const SpectrogramCache&) = delete;
+  SpectrogramCache& operator=(const SpectrogramCache&) = delete;
+
+  ~SpectrogramCache() { clear(); }
+
+  // memory budget in bytes; 0 disables in-memory caching
+  void budget(index bytes)
+  {
+    EntryList evicted;
+    {
+      std::lock_guard<std::mutex> lock(mMutex);
+      mBudget = bytes;
+      evict(evicted);
+    }
+    spill(evicted);
+  }
+
+  index budget() const
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mBudget;
+  }
+
+  index used() const
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mUsed;
+  }
+
+  // directory for spilled entries; empty (the default) disables spilling
+  void spillDirectory(std::string path)
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mSpillDirectory = std::move(path);
+  }
+
+  // drops every entry, in memory and spilled
+  void clear()
+  {
+    std::map<Key, std::string> spilled;
+    {
+      std::lock_guard<std::mutex> lock(mMutex);
+      mEntries.clear();
+      mLookup.clear();
+      mUsed = 0;
+      std::swap(spilled, mSpilled);
+    }
+    for (auto& f : spilled) std::remove(f.second.c_str());
+  }
+
+  // Returns the STFT of audio for these settings, computing it on a miss
+  Pointer get(const RealVectorView audio, const FFTParams& fftParams)
+  {
+    Key key = makeKey(audio, fftParams);
+
+    {
+      std::lock_guard<std::mutex> lock(mMutex);
+      auto                        found = mLookup.find(key);
+      if (found != mLookup.end())
+      {
+        mEntries.splice(mEntries.begin(), mEntries, found->second);
+        return found->second->data;
+      }
+    }
+
+    Pointer result = load(key);
+
+    if (!result) result = compute(audio, fftParams);
+
+    insert(key, result);
+    return result;
+  }
+
+  // the STFT of audio, without going through the cache
+  static Pointer compute(const RealVectorView audio, const FFTParams& fftParams)
+  {
+    index nWindows = static_cast<index>(std::floor(
+        (audio.size() + fftParams.hopSize()) / fftParams.hopSize()));
+    auto  spectrum =
+        std::make_shared<ComplexMatrix>(nWindows, fftParams.frameSize());
+    auto stft = algorithm::STFT(fftParams.winSize(), fftParams.fftSize(),
+                                fftParams.hopSize());
+    stft.process(audio, *spectrum);
+    return spectrum;
+  }
+
+private:
+  SpectrogramCache() = default;
+
+  struct Key
+  {
+    uint64_t hash1;
+    uint64_t hash2;
+    index    size;
+    index    winSize;
+    index    hopSize;
+    index    fftSize;
+
+    bool operator<(const Key& x) const
+    {
+      return std::tie(hash1, hash2, size, winSize, hopSize, fftSize) <
+             std::tie(x.hash1, x.hash2, x.size, x.winSize, x.hopSize,
+                      x.fftSize);
+    }
+  };
+
+  struct Entry
+  {
+    Key     key;
+    Pointer data;
+    index   bytes;
+  };
+
+  using EntryList = std::list<Entry>;
+
+  static Key makeKey(const RealVectorView audio, const FFTParams& fftParams)
+  {
+    // FNV-1a over the samples, alongside a multiplicative hash with a
+    // different mixing, so a collision needs both to agree
+    uint64_t h1 = 14695981039346656037ull;
+    uint64_t h2 = 0x9E3779B97F4A7C15ull;
+    for (double x : audio)
+    {
+      uint64_t bits;
+      std::memcpy(&bits, &x, sizeof(bits));
+      for (int i = 0; i < 8; ++i)
+        h1 = (h1 ^ ((bits >> (8 * i)) & 0xff)) * 1099511628211ull;
+      h2 = (h2 ^ bits) * 0xBF58476D1CE4E5B9ull;
+      h2 ^= h2 >> 31;
+    }
+    return {h1,
+            h2,
+            audio.size(),
+            fftParams.winSize(),
+            fftParams.hopSize(),
+            fftParams.fftSize()};
+  }
+
+  static index bytesFor(const ComplexMatrix& spectrum)
+  {
+    return spectrum.size() * asSigned(sizeof(std::complex<double>));
+  }
+
+  void insert(const Key& key, Pointer data)
+  {
+    EntryList evicted;
+    {
+      std::lock_guard<std::mutex> lock(mMutex);
+      if (mLookup.find(key) != mLookup.end()) return; // another thread won
+      index bytes = bytesFor(*data);
+      if (bytes > mBudget)
+        evicted.push_back({key, std::move(data), bytes});
+      else
+      {
+        mEntries.push_front({key, std::move(data), bytes});
+        mLookup[key] = mEntries.begin();
+        mUsed += bytes;
+        evict(evicted);
+      }
+    }
+    spill(evicted);
+  }
+
+  // called with the lock held; moves entries over budget to evicted
+  void evict(EntryList& evicted)
+  {
+    while (mUsed > mBudget && !mEntries.empty())
+    {
+      mUsed -= mEntries.back().bytes;
+      mLookup.erase(mEntries.back().key);
+      evicted.splice(evicted.end(), mEntries, std::prev(mEntries.end()));
+    }
+  }
+
+  // called without the lock; entries evicted meanwhile are missed until their
+  // file is registered, and are recomputed if asked for
+  void spill(const EntryList& evicted)
+  {
+    if (evicted.empty()) return;
+    std::string directory;
+    {
+      std::lock_guard<std::mutex> lock(mMutex);
+      directory = mSpillDirectory;
+    }
+    if (directory.empty()) return;
+    for (auto& entry : evicted)
+    {
+      const Key& key = entry.key;
+      {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (mSpilled.count(key)) continue;
+      }
+      std::ostringstream name;
+      name << directory << "/fluid_spectrogram_" << std::hex
+           << std::setfill('0') << std::setw(16) << key.hash1 << std::setw(16)
+           << key.hash2 << std::dec << '_' << key.winSize << '_'
+           << key.hopSize << '_' << key.fftSize << ".bin";
+      std::ofstream file(name.str(), std::ios::binary);
+      if (!file) continue;
+      const ComplexMatrix& spectrum = *entry.data;
+      index                dims[2]{spectrum.rows(), spectrum.cols()};
+      file.write(reinterpret_cast<const char*>(dims), sizeof(dims));
+      file.write(reinterpret_cast<const char*>(spectrum.data()),
+                 static_cast<std::streamsize>(bytesFor(spectrum)));
+      if (!file) continue;
+      std::lock_guard<std::mutex> lock(mMutex);
+      mSpilled[key] = name.str();
+    }
+  }
+
+  Pointer load(const Key& key)
+  {
+    std::string path;
+    {
+      std::lock_guard<std::mutex> lock(mMutex);
+      auto                        found = mSpilled.find(key);
+      if (found == mSpilled.end()) return nullptr;
+      path = found->second;
+    }
+    std::ifstream file(path, std::ios::binary);
+    index         dims[2];
+    if (!file.read(reinterpret_cast<char*>(dims), sizeof(dims)))
+      return nullptr;
+    auto spectrum = std::make_shared<ComplexMatrix>(dims[0], dims[1]);
+    if (!file.read(reinterpret_cast<char*>(spectrum->data()),
+                   static_cast<std::streamsize>(bytesFor(*spectrum))))
+      return nullptr;
+    return spectrum;
+  }
+
+  mutable std::mutex                 mMutex;
+  EntryList                          mEntries;
+  std::map<Key, EntryList::iterator> mLookup;
+  std::map<Key, std::string>         mSpilled;
+  std::string                        mSpillDirectory;
+  index                              mBudget{0};
+  index                              mUsed{0};
+};
+
+} // namespace client
+} // namespace fluid
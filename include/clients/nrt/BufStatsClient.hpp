@@ -14,6 +14,10 @@ under the European Union’s Horizon 2020 research and innovation programme
 #include "../common/ParameterConstraints.hpp"
 #include "../common/ParameterTypes.hpp"
 #include "../../algorithms/public/Stats.hpp"
+#include "../../algorithms/util/ParallelFor.hpp"
+#include <atomic>
+#include <thread>
+#include <vector>
 
 namespace fluid {
 namespace client {
@@ -28,7 +32,8 @@ enum BufStatsParamIndex {
   kNumDerivatives,
   kLow,
   kMiddle,
-  kHigh
+  kHigh,
+  kApproximate
 };
 
 auto constexpr BufStatsParams = defineParameters(
@@ -44,7 +49,8 @@ auto constexpr BufStatsParams = defineParameters(
     FloatParam("middle", "Middle Percentile", 50, Min(0), Max(100),
                LowerLimit<kLow>(), UpperLimit<kHigh>()),
     FloatParam("high", "High Percentile", 100, Min(0), Max(100),
-               LowerLimit<kMiddle>()));
+               LowerLimit<kMiddle>()),
+    EnumParam("approximate", "Approximate Percentiles", 0, "Off", "On"));
 
 template <typename T>
 class BufStatsClient
@@ -109,22 +115,42 @@ public:
 
     if (!resizeResult.ok()) return resizeResult;
 
-    processor.init(get<kNumDerivatives>(), get<kLow>(), get<kMiddle>(),
-                   get<kHigh>());
-    for (int i = 0; i < numChannels; i++)
-    {
-      auto sourceChannel = FluidTensor<double, 1>(numFrames);
-      auto destChannel = FluidTensor<double, 1>(outputSize);
-      for (int j = 0; j < numFrames; j++)
-        sourceChannel(j) =
-            source.samps(get<kOffset>(), numFrames, get<kStartChan>() + i)(j);
-      processor.process(sourceChannel, destChannel);
-
-      if (c.task() && !c.task()->processUpdate(i + 1, numChannels))
-        return {Result::Status::kCancelled, ""};
-
-      for (index j = 0; j < outputSize; j++) dest.samps(i)(j) = static_cast<float>(destChannel(j));
-    }
+    index  numDerivatives = get<kNumDerivatives>();
+    double low = get<kLow>(), middle = get<kMiddle>(), high = get<kHigh>();
+    bool   approximate = get<kApproximate>() == 1;
+
+    // channels are read whole as views, and converted a chunk at a time by
+    // their own processor
+    std::vector<FluidTensorView<const float, 1>> sourceChannels;
+    for (index i = 0; i < numChannels; i++)
+      sourceChannels.push_back(
+          source.samps(get<kOffset>(), numFrames, get<kStartChan>() + i));
+    RealMatrix results(numChannels, outputSize);
+
+    // every thread counts the channels it finishes, but only the calling
+    // thread (which takes channels too) reports them, so progress can't go
+    // backwards
+    std::atomic<index> done{0};
+    auto               caller = std::this_thread::get_id();
+    auto cancelled = [&c]() { return c.task() && c.task()->cancelled(); };
+
+    algorithm::parallelFor(numChannels, [&](index i) {
+      if (cancelled()) return;
+      algorithm::Stats channelProcessor;
+      channelProcessor.init(numDerivatives, low, middle, high, approximate);
+      channelProcessor.begin(numFrames);
+      channelProcessor.add(sourceChannels[asUnsigned(i)]);
+      channelProcessor.finish(results.row(i));
+      index finished = ++done;
+      if (c.task() && std::this_thread::get_id() == caller)
+        c.task()->processUpdate(finished, numChannels);
+    });
+
+    if (cancelled()) return {Result::Status::kCancelled, ""};
+    if (c.task()) c.task()->processUpdate(numChannels, numChannels);
+
+    for (index i = 0; i < numChannels; i++)
+      dest.samps(i) = results.row(i);
 
     return {Result::Status::kOk, ""};
   }
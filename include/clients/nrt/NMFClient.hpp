@@ -15,12 +15,17 @@ under the European Union’s Horizon 2020 research and innovation programme
 #include "../common/ParameterConstraints.hpp"
 #include "../common/ParameterSet.hpp"
 #include "../common/ParameterTypes.hpp"
+#include "../common/SpectrogramCache.hpp"
 #include "../../algorithms/public/NMF.hpp"
-#include "../../algorithms/public/RatioMask.hpp"
 #include "../../algorithms/public/STFT.hpp"
+#include "../../algorithms/util/AlgorithmUtils.hpp"
+#include "../../algorithms/util/ParallelFor.hpp"
 #include "../../data/FluidTensor.hpp"
+#include "../../data/TensorTypes.hpp"
 #include <algorithm> //for max_element
+#include <atomic>
 #include <cassert>
+#include <mutex>
 #include <sstream> //for ostringstream
 #include <string>
 #include <unordered_set>
@@ -43,7 +48,8 @@ enum NMFParamIndex {
   kEnvelopesUpdate,
   kRank,
   kIterations,
-  kFFT
+  kFFT,
+  kCacheSize
 };
 
 auto constexpr NMFParams = defineParameters(
@@ -61,7 +67,8 @@ auto constexpr NMFParams = defineParameters(
               "Fixed"),
     LongParam("components", "Number of Components", 1, Min(1)),
     LongParam("iterations", "Number of Iterations", 100, Min(1)),
-    FFTParam("fftSettings", "FFT Settings", 1024, -1, -1));
+    FFTParam("fftSettings", "FFT Settings", 1024, -1, -1),
+    LongParam("cacheSize", "STFT Cache Size (MB)", 0, Min(0)));
 
 template <typename T>
 class NMFClient : public FluidBaseClient<decltype(NMFParams), NMFParams>,
@@ -178,126 +185,236 @@ public:
       if (!resizeResult.ok()) return resizeResult;
     }
 
-    auto stft = algorithm::STFT(fftParams.winSize(), fftParams.fftSize(),
-                                fftParams.hopSize());
+    index rank = get<kRank>();
 
-    auto tmp = FluidTensor<double, 1>(nFrames);
-    auto seededFilters = FluidTensor<double, 2>(0, 0);
-    auto seededEnvelopes = FluidTensor<double, 2>(0, 0);
-    auto outputFilters = FluidTensor<double, 2>(get<kRank>(), nBins);
-    auto outputEnvelopes = FluidTensor<double, 2>(nWindows, get<kRank>());
-    auto spectrum = FluidTensor<std::complex<double>, 2>(nWindows, nBins);
-    auto magnitude = FluidTensor<double, 2>(nWindows, nBins);
-    auto outputMags = FluidTensor<double, 2>(nWindows, nBins);
-
-    if (seedFilters || fixFilters) seededFilters.resize(get<kRank>(), nBins);
-    if (seedEnvelopes || fixEnvelopes)
-      seededEnvelopes.resize((nFrames / fftParams.hopSize()) + 1, get<kRank>());
-
-
-    const double progressTotal =
-        get<kIterations>() + (hasResynth ? 3 * get<kRank>() : 0);
+    // All buffer and task access stays on this thread: sources and seeds are
+    // read up front, and each channel's results are written back and freed
+    // as soon as its worker hands them over
+    auto sources = std::vector<RealVector>(asUnsigned(nChannels));
+    auto seededFilters = std::vector<RealMatrix>(asUnsigned(nChannels));
+    auto seededEnvelopes = std::vector<RealMatrix>(asUnsigned(nChannels));
 
     for (index i = 0; i < nChannels; ++i)
     {
-      if (c.task() && !c.task()->iterationUpdate(i, nChannels))
-        return {Result::Status::kCancelled, ""};
-      //          tmp = sourceData.col(i);
-      tmp = source.samps(get<kOffset>(), nFrames, get<kStartChan>() + i);
-      stft.process(tmp, spectrum);
-      algorithm::STFT::magnitude(spectrum, magnitude);
-      int progressCount{0};
+      auto chan = asUnsigned(i);
+      sources[chan] = RealVector(
+          source.samps(get<kOffset>(), nFrames, get<kStartChan>() + i));
+      seededFilters[chan].resize(0, 0);
+      seededEnvelopes[chan].resize(0, 0);
       // For multichannel dictionaries, seed data could be all over the place,
       // so we'll build it up by hand :-/
-      for (index j = 0; j < get<kRank>(); ++j)
+      if (seedFilters || fixFilters)
       {
-        if (seedFilters || fixFilters)
-        {
-          auto filters = BufferAdaptor::Access{get<kFilters>().get()};
-          seededFilters.row(j) = filters.samps(i * get<kRank>() + j);
-        }
-        if (seedEnvelopes || fixEnvelopes)
-        {
-          auto envelopes = BufferAdaptor::Access(get<kEnvelopes>().get());
-          seededEnvelopes.col(j) = envelopes.samps(i * get<kRank>() + j);
-        }
+        auto filters = BufferAdaptor::ReadAccess{get<kFilters>().get()};
+        seededFilters[chan].resize(rank, nBins);
+        for (index j = 0; j < rank; ++j)
+          seededFilters[chan].row(j) = filters.samps(i * rank + j);
       }
+      if (seedEnvelopes || fixEnvelopes)
+      {
+        auto envelopes = BufferAdaptor::ReadAccess(get<kEnvelopes>().get());
+        seededEnvelopes[chan].resize((nFrames / fftParams.hopSize()) + 1,
+                                     rank);
+        for (index j = 0; j < rank; ++j)
+          seededEnvelopes[chan].col(j) = envelopes.samps(i * rank + j);
+      }
+    }
+
+    struct ChannelResult
+    {
+      index      channel;
+      RealMatrix filters;
+      RealMatrix envelopes;
+      RealMatrix resynth;
+    };
 
-      auto nmf = algorithm::NMF();
-      nmf.addProgressCallback(
-          [&c, &progressCount, progressTotal](const int) -> bool {
-            return c.task()
-                       ? c.task()->processUpdate(++progressCount, progressTotal)
-                       : true;
-          });
-      nmf.process(magnitude, outputFilters, outputEnvelopes, outputMags,
-                  get<kRank>(), get<kIterations>(), !fixFilters, !fixEnvelopes,
-                  seededFilters, seededEnvelopes);
+    std::mutex                 finishedMutex;
+    std::vector<ChannelResult> finished; // guarded by finishedMutex
 
-      if (c.task() && c.task()->cancelled())
-        return {Result::Status::kCancelled, ""};
+    // workers only count progress and check the stop flag; this thread
+    // reports it and passes cancellation on
+    const double progressTotal =
+        nChannels * (get<kIterations>() + (hasResynth ? rank : 0));
+    std::atomic<index> progressCount{0};
+    std::atomic<bool>  stop{false};
+
+    auto progress = [&progressCount, &stop]() -> bool {
+      ++progressCount;
+      return !stop;
+    };
+
+    auto writeBack = [&](ChannelResult& result) {
+      index i = result.channel;
 
       // Write W?
       if (hasFilters && !fixFilters)
       {
-        //        auto finalFilters = m.getW();
         auto filters = BufferAdaptor::Access{get<kFilters>().get()};
-        for (index j = 0; j < get<kRank>(); ++j)
-        { filters.samps(i * get<kRank>() + j) = outputFilters.row(j); }
+        for (index j = 0; j < rank; ++j)
+          filters.samps(i * rank + j) = result.filters.row(j);
       }
 
       // Write H? Need to normalise also
       if (hasEnvelopes && !fixEnvelopes)
       {
-        //        auto finalEnvelopes = m.getH();
-        auto maxH =
-            *std::max_element(outputEnvelopes.begin(), outputEnvelopes.end());
-        auto scale = 1. / (maxH);
-        auto envelopes = BufferAdaptor::Access{get<kEnvelopes>().get()};
+        auto& outputEnv = result.envelopes;
+        auto  maxH = *std::max_element(outputEnv.begin(), outputEnv.end());
+        auto  scale = 1. / (maxH);
+        auto  envelopes = BufferAdaptor::Access{get<kEnvelopes>().get()};
 
-        for (index j = 0; j < get<kRank>(); ++j)
+        for (index j = 0; j < rank; ++j)
         {
-          auto env = envelopes.samps(i * get<kRank>() + j);
-          env = outputEnvelopes.col(j);
+          auto env = envelopes.samps(i * rank + j);
+          env = outputEnv.col(j);
           env.apply([scale](float& x) { x *= static_cast<float>(scale); });
         }
       }
 
       if (hasResynth)
       {
-        auto mask = algorithm::RatioMask();
-        mask.init(outputMags);
-        auto resynthMags = FluidTensor<double, 2>(nWindows, nBins);
-        auto resynthSpectrum =
-            FluidTensor<std::complex<double>, 2>(nWindows, nBins);
-        auto istft = algorithm::ISTFT{fftParams.winSize(), fftParams.fftSize(),
-                                      fftParams.hopSize()};
-        auto resynthAudio = FluidTensor<double, 1>(nFrames);
         auto resynth = BufferAdaptor::Access{get<kResynth>().get()};
+        for (index j = 0; j < rank; ++j)
+          resynth.samps(i * rank + j) = result.resynth.row(j);
+      }
+    };
 
-        // const index subProgress = 3 * get<kRank>();
+    auto poll = [&]() {
+      if (c.task() &&
+          (!c.task()->processUpdate(progressCount, progressTotal) ||
+           c.task()->cancelled()))
+        stop = true;
 
-        for (index j = 0; j < get<kRank>(); ++j)
-        {
-          algorithm::NMF::estimate(outputFilters, outputEnvelopes, j,
-                                   resynthMags);
-          if (c.task() &&
-              !c.task()->processUpdate(++progressCount, progressTotal))
-            return {Result::Status::kCancelled, ""};
-          mask.process(spectrum, resynthMags, 1, resynthSpectrum);
-          if (c.task() &&
-              !c.task()->processUpdate(++progressCount, progressTotal))
-            return {Result::Status::kCancelled, ""};
-          istft.process(resynthSpectrum, resynthAudio);
-          resynth.samps(i * get<kRank>() + j) = resynthAudio(Slice(0, nFrames));
-          if (c.task() &&
-              !c.task()->processUpdate(++progressCount, progressTotal))
-            return {Result::Status::kCancelled, ""};
-        }
+      std::vector<ChannelResult> ready;
+      {
+        std::lock_guard<std::mutex> lock(finishedMutex);
+        ready.swap(finished);
       }
-    }
+      if (!stop)
+        for (auto& result : ready) writeBack(result);
+    };
+
+    // Channels share the pool first; what's left over goes to the ranks
+    index nThreads = algorithm::defaultThreadCount();
+    index channelThreads = std::min(nThreads, nChannels);
+    index rankThreads = std::max<index>(1, nThreads / channelThreads);
+
+    // the overlap-add normalisation only depends on the FFT settings, so is
+    // shared by every channel and component
+    auto norm = overlapNorm(nWindows, fftParams);
+
+    // the cache is shared by every BufNMF in the process, and a size of 0
+    // empties it as well as bypassing it
+    index cacheBytes = get<kCacheSize>() * 1024 * 1024;
+    SpectrogramCache::instance().budget(cacheBytes);
+    if (!cacheBytes) SpectrogramCache::instance().clear();
+
+    algorithm::parallelForPolled(
+        nChannels,
+        [&](index i) {
+          auto chan = asUnsigned(i);
+          if (stop) return;
+          // with a cache, repeated runs over the same audio and settings
+          // reuse the STFT
+          auto spectrum =
+              cacheBytes
+                  ? SpectrogramCache::instance().get(sources[chan], fftParams)
+                  : SpectrogramCache::compute(sources[chan], fftParams);
+          auto magnitude = RealMatrix(nWindows, nBins);
+          auto outputMags = RealMatrix(nWindows, nBins);
+          algorithm::STFT::magnitude(*spectrum, magnitude);
+
+          auto result = ChannelResult{i, RealMatrix(rank, nBins),
+                                      RealMatrix(nWindows, rank),
+                                      RealMatrix(hasResynth ? rank : 0,
+                                                 hasResynth ? nFrames : 0)};
+          auto nmf = algorithm::NMF();
+          nmf.addProgressCallback(
+              [&progress](const index) -> bool { return progress(); });
+          nmf.process(magnitude, result.filters, result.envelopes, outputMags,
+                      rank, get<kIterations>(), !fixFilters, !fixEnvelopes,
+                      seededFilters[chan], seededEnvelopes[chan]);
+          sources[chan] = RealVector();
+          seededFilters[chan] = RealMatrix();
+          seededEnvelopes[chan] = RealMatrix();
+
+          if (stop) return;
+
+          if (hasResynth)
+            algorithm::parallelFor(
+                rank,
+                [&](index j) {
+                  if (stop) return;
+                  resynthesise(*spectrum, outputMags, result.filters,
+                               result.envelopes, j, norm, fftParams,
+                               result.resynth.row(j));
+                  progress();
+                },
+                rankThreads);
+
+          std::lock_guard<std::mutex> lock(finishedMutex);
+          finished.push_back(std::move(result));
+        },
+        poll, channelThreads);
+
+    if (stop) return {Result::Status::kCancelled, ""};
+
     return {Result::Status::kOk, ""};
   }
+
+private:
+  // the summed squared windows that ISTFT::process divides by
+  static RealVector overlapNorm(index nWindows, const FFTParams& fftParams)
+  {
+    index winSize = fftParams.winSize();
+    index hopSize = fftParams.hopSize();
+    auto  istft = algorithm::ISTFT(winSize, fftParams.fftSize(), hopSize);
+    auto  window = istft.window();
+    auto  norm = RealVector(2 * winSize + nWindows * hopSize);
+    for (index i = 0; i < nWindows; ++i)
+      norm(Slice(i * hopSize, winSize))
+          .apply(window, [](double& x, double w) { x += w * w; });
+    return norm;
+  }
+
+  // Ratio-masks one component out of the mixture and overlap-adds it frame
+  // by frame, equivalent to NMF::estimate, RatioMask and ISTFT::process in
+  // turn but without building the component's whole spectrogram
+  static void resynthesise(const ComplexMatrixView spectrum,
+                           const RealMatrixView    mixMags,
+                           const RealMatrixView W, const RealMatrixView H,
+                           index component, const RealVector& norm,
+                           const FFTParams& fftParams, RealVectorView output)
+  {
+    using algorithm::epsilon;
+    index winSize = fftParams.winSize();
+    index hopSize = fftParams.hopSize();
+    index nWindows = spectrum.rows();
+    index nBins = spectrum.cols();
+    auto  istft = algorithm::ISTFT(winSize, fftParams.fftSize(), hopSize);
+    auto  frame = ComplexVector(nBins);
+    auto  grain = RealVector(winSize);
+    auto  padded = RealVector(norm.size());
+
+    for (index i = 0; i < nWindows; ++i)
+    {
+      double h = H(i, component);
+      for (index k = 0; k < nBins; ++k)
+      {
+        double mask = std::min(
+            (W(component, k) * h) * (1 / std::max(mixMags(i, k), epsilon)),
+            1.0);
+        frame(k) = spectrum(i, k) * mask;
+      }
+      istft.processFrame(frame, grain);
+      padded(Slice(i * hopSize, winSize))
+          .apply(grain, [](double& x, double y) { x += y; });
+    }
+
+    index halfWindow = winSize / 2;
+    for (index i = 0; i < output.size(); ++i)
+      output(i) =
+          padded(i + halfWindow) / std::max(norm(i + halfWindow), epsilon);
+  }
 };
 
 template <typename T>
@@ -0,0 +1,234 @@
+/*
+Part of the Fluid Corpus Manipulation Project (http://www.flucoma.org/)
+Copyright 2017-2019 University of Huddersfield.
+Licensed under the BSD-3 License.
+See license.md file in the project root for full license information.
+This project has received funding from the European Research Council (ERC)
+under the European Union’s Horizon 2020 research and innovation programme
+(grant agreement No 725899).
+*/
+#pragma once
+
+#include "../common/FluidBaseClient.hpp"
+#include "../common/FluidNRTClientWrapper.hpp"
+#include "../common/OfflineClient.hpp"
+#include "../common/ParameterConstraints.hpp"
+#include "../common/ParameterSet.hpp"
+#include "../common/ParameterTypes.hpp"
+#include "../../algorithms/public/OnlineNMF.hpp"
+#include "../../algorithms/public/STFT.hpp"
+#include "../../data/FluidTensor.hpp"
+#include <algorithm>
+#include <cassert>
+
+namespace fluid {
+namespace client {
+
+enum OnlineNMFParamIndex {
+  kSource,
+  kOffset,
+  kNumFrames,
+  kStartChan,
+  kNumChans,
+  kFilters,
+  kFiltersUpdate,
+  kEnvelopes,
+  kRank,
+  kIterations,
+  kBatchSize,
+  kPasses,
+  kFFT
+};
+
+auto constexpr OnlineNMFParams = defineParameters(
+    InputBufferParam("source", "Source Buffer"),
+    LongParam("startFrame", "Source Offset", 0, Min(0)),
+    LongParam("numFrames", "Number of Frames", -1),
+    LongParam("startChan", "Start Channel", 0, Min(0)),
+    LongParam("numChans", "Number Channels", -1),
+    BufferParam("bases", "Bases Buffer"),
+    EnumParam("basesMode", "Bases Buffer Update Mode", 0, "None", "Seed"),
+    BufferParam("activations", "Activations Buffer"),
+    LongParam("components", "Number of Components", 1, Min(1)),
+    LongParam("iterations", "Number of Iterations per Batch", 10, Min(1)),
+    LongParam("batchSize", "Frames per Batch", 64, Min(1)),
+    LongParam("passes", "Number of Passes", 1, Min(1)),
+    FFTParam("fftSettings", "FFT Settings", 1024, -1, -1));
+
+/***
+ Learns NMF bases from a buffer in mini-batches of STFT frames, so that only
+ one batch of spectra is ever held in memory. Activations, when requested, are
+ computed in a final pass against the learned (fixed) bases.
+ ***/
+template <typename T>
+class OnlineNMFClient
+    : public FluidBaseClient<decltype(OnlineNMFParams), OnlineNMFParams>,
+      public OfflineIn,
+      public OfflineOut
+{
+public:
+  OnlineNMFClient(ParamSetViewType& p) : FluidBaseClient(p) {}
+
+  Result process(FluidContext& c)
+  {
+    index nFrames = get<kNumFrames>();
+    index nChannels = get<kNumChans>();
+    auto  rangeCheck = bufferRangeCheck(get<kSource>().get(), get<kOffset>(),
+                                       nFrames, get<kStartChan>(), nChannels);
+
+    if (!rangeCheck.ok()) return rangeCheck;
+
+    auto   source = BufferAdaptor::ReadAccess(get<kSource>().get());
+    double sampleRate = source.sampleRate();
+    auto   fftParams = get<kFFT>();
+    index  rank = get<kRank>();
+
+    index nWindows = static_cast<index>(
+        std::floor((nFrames + fftParams.hopSize()) / fftParams.hopSize()));
+    index nBins = fftParams.frameSize();
+    index batchSize = std::min(get<kBatchSize>(), nWindows);
+
+    const bool seedFilters{get<kFiltersUpdate>() > 0};
+
+    if (!get<kFilters>())
+      return {Result::Status::kError, "No Bases Buffer supplied"};
+
+    {
+      BufferAdaptor::Access buf(get<kFilters>().get());
+      if (!buf.exists())
+        return {Result::Status::kError, "Filter Buffer Supplied But Invalid"};
+
+      if (seedFilters && (!buf.valid() || buf.numFrames() != nBins ||
+                          buf.numChans() != rank * nChannels))
+        return {Result::Status::kError,
+                "Supplied filter buffer for seeding must be [(FFTSize / 2) + "
+                "1] frames long, and have [rank] * [channels] channels"};
+    }
+
+    bool hasEnvelopes{false};
+
+    if (get<kEnvelopes>())
+    {
+      BufferAdaptor::Access buf(get<kEnvelopes>().get());
+      if (!buf.exists())
+        return {Result::Status::kError, "Envelope Buffer Supplied But Invalid"};
+      hasEnvelopes = true;
+    }
+
+    auto stft = algorithm::STFT(fftParams.winSize(), fftParams.fftSize(),
+                                fftParams.hopSize());
+    auto nmf = algorithm::OnlineNMF();
+
+    auto window = FluidTensor<double, 1>(fftParams.winSize());
+    auto spectrum = FluidTensor<std::complex<double>, 1>(nBins);
+    auto magnitudes = FluidTensor<double, 2>(batchSize, nBins);
+    auto activations = FluidTensor<double, 2>(batchSize, rank);
+    auto filters = FluidTensor<double, 2>(rank, nBins);
+    auto envelopes = FluidTensor<double, 2>(hasEnvelopes ? nWindows : 0, rank);
+    auto outputFilters = FluidTensor<double, 2>(rank * nChannels, nBins);
+
+    index nBatches = (nWindows + batchSize - 1) / batchSize;
+    index nPasses = get<kPasses>() + hasEnvelopes;
+
+    for (index i = 0; i < nChannels; ++i)
+    {
+      if (c.task() && !c.task()->iterationUpdate(i, nChannels))
+        return {Result::Status::kCancelled, ""};
+
+      if (seedFilters)
+      {
+        auto seed = BufferAdaptor::ReadAccess(get<kFilters>().get());
+        for (index j = 0; j < rank; ++j)
+          filters.row(j) = seed.samps(i * rank + j);
+        nmf.init(filters, batchSize);
+      }
+      else
+        nmf.init(nBins, rank, batchSize);
+
+      for (index pass = 0; pass < nPasses; ++pass)
+      {
+        // with an activations buffer, the last pass only reads them out
+        bool learn = !hasEnvelopes || pass < nPasses - 1;
+
+        for (index b = 0; b < nBatches; ++b)
+        {
+          index start = b * batchSize;
+          index count = std::min(batchSize, nWindows - start);
+          for (index k = 0; k < count; ++k)
+          {
+            readWindow(source, i, start + k, nFrames, fftParams, window);
+            stft.processFrame(window, spectrum);
+            algorithm::STFT::magnitude(spectrum, magnitudes.row(k));
+          }
+          nmf.processBatch(magnitudes(Slice(0, count), Slice(0)),
+                           activations(Slice(0, count), Slice(0)),
+                           get<kIterations>(), learn);
+          if (!learn)
+            envelopes(Slice(start, count), Slice(0)) =
+                activations(Slice(0, count), Slice(0));
+
+          if (c.task() &&
+              !c.task()->processUpdate(pass * nBatches + b + 1,
+                                       nPasses * nBatches))
+            return {Result::Status::kCancelled, ""};
+        }
+      }
+
+      nmf.getBases(filters);
+      outputFilters(Slice(i * rank, rank), Slice(0)) = filters;
+
+      if (hasEnvelopes)
+      {
+        if (i == 0)
+        {
+          Result resizeResult =
+              BufferAdaptor::Access(get<kEnvelopes>().get())
+                  .resize(nWindows, nChannels * rank,
+                          sampleRate / fftParams.hopSize());
+          if (!resizeResult.ok()) return resizeResult;
+        }
+        auto maxH = *std::max_element(envelopes.begin(), envelopes.end());
+        auto scale = 1. / (maxH);
+        auto dest = BufferAdaptor::Access{get<kEnvelopes>().get()};
+        for (index j = 0; j < rank; ++j)
+        {
+          auto env = dest.samps(i * rank + j);
+          env = envelopes.col(j);
+          env.apply([scale](float& x) { x *= static_cast<float>(scale); });
+        }
+      }
+    }
+
+    // written last so that a seeding buffer is not overwritten while in use
+    auto dest = BufferAdaptor::Access{get<kFilters>().get()};
+    Result resizeResult =
+        dest.resize(nBins, nChannels * rank, sampleRate / fftParams.fftSize());
+    if (!resizeResult.ok()) return resizeResult;
+    for (index j = 0; j < nChannels * rank; ++j)
+      dest.samps(j) = outputFilters.row(j);
+
+    return {Result::Status::kOk, ""};
+  }
+
+private:
+  // fill one analysis window, zero padded as STFT::process does
+  void readWindow(BufferAdaptor::ReadAccess& source, index chan, index frame,
+                  index nFrames, const FFTParams& fftParams,
+                  FluidTensor<double, 1>& window)
+  {
+    index winSize = fftParams.winSize();
+    index start = frame * fftParams.hopSize() - winSize / 2;
+    index from = std::max<index>(start, 0);
+    index to = std::min(start + winSize, nFrames);
+    window.fill(0);
+    if (to > from)
+      window(Slice(from - start, to - from)) = source.samps(
+          get<kOffset>() + from, to - from, get<kStartChan>() + chan);
+  }
+};
+
+template <typename T>
+using NRTThreadedOnlineNMFClient = NRTThreadingAdaptor<OnlineNMFClient<T>>;
+
+} // namespace client
+} // namespace fluid
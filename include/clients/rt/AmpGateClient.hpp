@@ -35,7 +35,9 @@ enum AmpGateParamIndex {
   kUpwardLookupTime,
   kDownwardLookupTime,
   kHiPassFreq,
-  kMaxSize
+  kMaxSize,
+  kApproximateLog,
+  kAmpGateChannels
 };
 
 extern auto constexpr AmpGateParams = defineParameters(
@@ -52,7 +54,8 @@ extern auto constexpr AmpGateParams = defineParameters(
     LongParam("lookBack", "Backward Lookup Length", 0, Min(0)),
     LongParam("lookAhead", "Forward Lookup Length", 0, Min(0)),
     FloatParam("highPassFreq", "High-Pass Filter Cutoff", 85, Min(0)),
-    LongParam<Fixed<true>>("maxSize", "Maximum Total Latency", 88200, Min(1)));
+    LongParam<Fixed<true>>("maxSize", "Maximum Total Latency", 88200, Min(1)),
+    EnumParam("approximateLog", "Approximate dB Conversion", 0, "Off", "On"));
 
 template <typename T>
 class AmpGateClient
@@ -63,7 +66,8 @@ class AmpGateClient
   using HostVector = FluidTensorView<T, 1>;
 
 public:
-  AmpGateClient(ParamSetViewType& p) : FluidBaseClient(p)
+  AmpGateClient(ParamSetViewType& p)
+      : FluidBaseClient(p), mBuffer(kChunkSize)
   {
     FluidBaseClient::audioChannelsIn(1);
     FluidBaseClient::audioChannelsOut(1);
@@ -88,12 +92,20 @@ public:
                       get<kDownwardLookupTime>());
     }
 
-    for (index i = 0; i < input[0].size(); i++)
+    // host vectors are converted and processed a chunk at a time, so any
+    // host vector size works without allocating here
+    index size = input[0].size();
+    for (index start = 0; start < size; start += mBuffer.size())
     {
-      output[0](i) = static_cast<T>(mAlgorithm.processSample(
-          input[0](i), get<kOnThreshold>(), get<kOffThreshold>(),
-          get<kRampUpTime>(), get<kRampDownTime>(), hiPassFreq,
-          get<kMinEventDuration>(), get<kMinSilenceDuration>()));
+      index n = std::min(size - start, mBuffer.size());
+      auto  buffer = mBuffer(Slice(0, n));
+      buffer = input[0](Slice(start, n));
+      mAlgorithm.process(buffer, buffer, get<kOnThreshold>(),
+                         get<kOffThreshold>(), get<kRampUpTime>(),
+                         get<kRampDownTime>(), hiPassFreq,
+                         get<kMinEventDuration>(), get<kMinSilenceDuration>(),
+                         get<kApproximateLog>() == 1);
+      output[0](Slice(start, n)) = buffer;
     }
   }
 
@@ -113,9 +125,113 @@ public:
   }
 
 private:
+  static constexpr index kChunkSize = 512;
+
   ParameterTrackChanges<index, index, index, index> mTrackValues;
 
   algorithm::EnvelopeGate mAlgorithm{get<kMaxSize>()};
+  RealVector              mBuffer;
+};
+
+extern auto constexpr MultiChannelAmpGateParams = defineParameters(
+    LongParam("rampUp", "Ramp Up Length", 10, Min(1)),
+    LongParam("rampDown", "Ramp Down Length", 10, Min(1)),
+    FloatParam("onThreshold", "On Threshold", -90, Min(-144), Max(144)),
+    FloatParam("offThreshold", "Off Threshold", -90, Min(-144), Max(144)),
+    LongParam("minSliceLength", "Minimum Length of Slice", 1, Min(1)),
+    LongParam("minSilenceLength", "Minimum Length of Silence", 1, Min(1)),
+    LongParam("minLengthAbove", "Required Minimum Length Above Threshold", 1,
+              Min(1)),
+    LongParam("minLengthBelow", "Required Minimum Length Below Threshold", 1,
+              Min(1)),
+    LongParam("lookBack", "Backward Lookup Length", 0, Min(0)),
+    LongParam("lookAhead", "Forward Lookup Length", 0, Min(0)),
+    FloatParam("highPassFreq", "High-Pass Filter Cutoff", 85, Min(0)),
+    LongParam<Fixed<true>>("maxSize", "Maximum Total Latency", 88200, Min(1)),
+    EnumParam("approximateLog", "Approximate dB Conversion", 0, "Off", "On"),
+    LongParam<Fixed<true>>("numChannels", "Number of Channels", 2, Min(1)));
+
+// AmpGate of several channels in one instance, high-passing channels
+// together; output channel i gates input channel i.
+template <typename T>
+class MultiChannelAmpGateClient
+    : public FluidBaseClient<decltype(MultiChannelAmpGateParams),
+                             MultiChannelAmpGateParams>,
+      public AudioIn,
+      public AudioOut
+{
+  using HostVector = FluidTensorView<T, 1>;
+
+public:
+  MultiChannelAmpGateClient(ParamSetViewType& p)
+      : FluidBaseClient(p), mBuffer(get<kAmpGateChannels>(), kChunkSize)
+  {
+    FluidBaseClient::audioChannelsIn(get<kAmpGateChannels>());
+    FluidBaseClient::audioChannelsOut(get<kAmpGateChannels>());
+  }
+
+  void process(std::vector<HostVector>& input, std::vector<HostVector>& output,
+               FluidContext&)
+  {
+    index channels = get<kAmpGateChannels>();
+    for (index i = 0; i < channels; i++)
+      if (!input[asUnsigned(i)].data()) return;
+
+    double hiPassFreq = std::min(get<kHiPassFreq>() / sampleRate(), 0.5);
+
+    if (mTrackValues.changed(
+            get<kMinTimeAboveThreshold>(), get<kUpwardLookupTime>(),
+            get<kMinTimeBelowThreshold>(), get<kDownwardLookupTime>()) ||
+        !mAlgorithm.initialized())
+    {
+      mAlgorithm.init(get<kOnThreshold>(), get<kOffThreshold>(), hiPassFreq,
+                      get<kMinTimeAboveThreshold>(), get<kUpwardLookupTime>(),
+                      get<kMinTimeBelowThreshold>(),
+                      get<kDownwardLookupTime>());
+    }
+
+    // as in AmpGateClient, a chunk at a time so as not to allocate here
+    index size = input[0].size();
+    for (index start = 0; start < size; start += mBuffer.cols())
+    {
+      index n = std::min(size - start, mBuffer.cols());
+      auto  buffer = mBuffer(Slice(0), Slice(0, n));
+      for (index i = 0; i < channels; i++)
+        buffer.row(i) = input[asUnsigned(i)](Slice(start, n));
+      mAlgorithm.process(buffer, buffer, get<kOnThreshold>(),
+                         get<kOffThreshold>(), get<kRampUpTime>(),
+                         get<kRampDownTime>(), hiPassFreq,
+                         get<kMinEventDuration>(), get<kMinSilenceDuration>(),
+                         get<kApproximateLog>() == 1);
+      for (index i = 0; i < channels; i++)
+        if (output[asUnsigned(i)].data())
+          output[asUnsigned(i)](Slice(start, n)) = buffer.row(i);
+    }
+  }
+
+  void reset()
+  {
+    double hiPassFreq = std::min(get<kHiPassFreq>() / sampleRate(), 0.5);
+    mAlgorithm.init(get<kOnThreshold>(), get<kOffThreshold>(), hiPassFreq,
+                    get<kMinTimeAboveThreshold>(), get<kUpwardLookupTime>(),
+                    get<kMinTimeBelowThreshold>(), get<kDownwardLookupTime>());
+  }
+
+  index latency()
+  {
+    return std::max(
+        get<kMinTimeAboveThreshold>() + get<kUpwardLookupTime>(),
+        std::max(get<kMinTimeBelowThreshold>(), get<kDownwardLookupTime>()));
+  }
+
+private:
+  static constexpr index kChunkSize = 512;
+
+  ParameterTrackChanges<index, index, index, index> mTrackValues;
+
+  algorithm::MultiChannelEnvelopeGate mAlgorithm{get<kMaxSize>(),
+                                                 get<kAmpGateChannels>()};
+  RealMatrix                          mBuffer;
 };
 
 template <typename HostMatrix, typename HostVectorView>
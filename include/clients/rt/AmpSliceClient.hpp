@@ -33,6 +33,8 @@ enum AmpSliceParamIndex {
   kSilenceThreshold,
   kDebounce,
   kHiPassFreq,
+  kApproximateLog,
+  kAmpSliceChannels
 };
 
 extern auto constexpr AmpSliceParams = defineParameters(
@@ -44,7 +46,8 @@ extern auto constexpr AmpSliceParams = defineParameters(
     FloatParam("offThreshold", "Off Threshold (dB)", -144, Min(-144), Max(144)),
     FloatParam("floor", "Floor value (dB)", -144, Min(-144), Max(144)),
     LongParam("minSliceLength", "Minimum Length of Slice", 2, Min(0)),
-    FloatParam("highPassFreq", "High-Pass Filter Cutoff", 85, Min(0)));
+    FloatParam("highPassFreq", "High-Pass Filter Cutoff", 85, Min(0)),
+    EnumParam("approximateLog", "Approximate dB Conversion", 0, "Off", "On"));
 
 template <typename T>
 class AmpSliceClient
@@ -55,7 +58,8 @@ class AmpSliceClient
   using HostVector = FluidTensorView<T, 1>;
 
 public:
-  AmpSliceClient(ParamSetViewType& p) : FluidBaseClient(p)
+  AmpSliceClient(ParamSetViewType& p)
+      : FluidBaseClient(p), mBuffer(kChunkSize)
   {
     FluidBaseClient::audioChannelsIn(1);
     FluidBaseClient::audioChannelsOut(1);
@@ -71,13 +75,21 @@ public:
 
     if (!mAlgorithm.initialized())
     { mAlgorithm.init(get<kSilenceThreshold>(), hiPassFreq); }
-    for (index i = 0; i < input[0].size(); i++)
+    // host vectors are converted and processed a chunk at a time, so any
+    // host vector size works without allocating here
+    index size = input[0].size();
+    for (index start = 0; start < size; start += mBuffer.size())
     {
-      output[0](i) = static_cast<T>(mAlgorithm.processSample(
-          input[0](i), get<kOnThreshold>(), get<kOffThreshold>(),
-          get<kSilenceThreshold>(), get<kFastRampUpTime>(),
-          get<kSlowRampUpTime>(), get<kFastRampDownTime>(),
-          get<kSlowRampDownTime>(), hiPassFreq, get<kDebounce>()));
+      index n = std::min(size - start, mBuffer.size());
+      auto  buffer = mBuffer(Slice(0, n));
+      buffer = input[0](Slice(start, n));
+      mAlgorithm.process(buffer, buffer, get<kOnThreshold>(),
+                         get<kOffThreshold>(), get<kSilenceThreshold>(),
+                         get<kFastRampUpTime>(), get<kSlowRampUpTime>(),
+                         get<kFastRampDownTime>(), get<kSlowRampDownTime>(),
+                         hiPassFreq, get<kDebounce>(),
+                         get<kApproximateLog>() == 1);
+      output[0](Slice(start, n)) = buffer;
     }
   }
   index latency() { return 0; }
@@ -88,8 +100,89 @@ public:
   }
 
 private:
+  static constexpr index kChunkSize = 512;
+
   algorithm::EnvelopeSegmentation mAlgorithm;
+  RealVector                      mBuffer;
+};
+extern auto constexpr MultiChannelAmpSliceParams = defineParameters(
+    LongParam("fastRampUp", "Fast Envelope Ramp Up Length", 1, Min(1)),
+    LongParam("fastRampDown", "Fast Envelope Ramp Down Length", 1, Min(1)),
+    LongParam("slowRampUp", "Slow Envelope Ramp Up Length", 100, Min(1)),
+    LongParam("slowRampDown", "Slow Envelope Ramp Down Length", 100, Min(1)),
+    FloatParam("onThreshold", "On Threshold (dB)", 144, Min(-144), Max(144)),
+    FloatParam("offThreshold", "Off Threshold (dB)", -144, Min(-144), Max(144)),
+    FloatParam("floor", "Floor value (dB)", -144, Min(-144), Max(144)),
+    LongParam("minSliceLength", "Minimum Length of Slice", 2, Min(0)),
+    FloatParam("highPassFreq", "High-Pass Filter Cutoff", 85, Min(0)),
+    EnumParam("approximateLog", "Approximate dB Conversion", 0, "Off", "On"),
+    LongParam<Fixed<true>>("numChannels", "Number of Channels", 2, Min(1)));
+
+// AmpSlice of several channels in one instance, high-passing channels
+// together; output channel i has the onsets of input channel i.
+template <typename T>
+class MultiChannelAmpSliceClient
+    : public FluidBaseClient<decltype(MultiChannelAmpSliceParams),
+                             MultiChannelAmpSliceParams>,
+      public AudioIn,
+      public AudioOut
+{
+  using HostVector = FluidTensorView<T, 1>;
+
+public:
+  MultiChannelAmpSliceClient(ParamSetViewType& p)
+      : FluidBaseClient(p), mBuffer(get<kAmpSliceChannels>(), kChunkSize)
+  {
+    FluidBaseClient::audioChannelsIn(get<kAmpSliceChannels>());
+    FluidBaseClient::audioChannelsOut(get<kAmpSliceChannels>());
+  }
+
+  void process(std::vector<HostVector>& input, std::vector<HostVector>& output,
+               FluidContext&)
+  {
+    index channels = get<kAmpSliceChannels>();
+    for (index i = 0; i < channels; i++)
+      if (!input[asUnsigned(i)].data()) return;
+
+    double hiPassFreq = std::min(get<kHiPassFreq>() / sampleRate(), 0.5);
+
+    if (!mAlgorithm.initialized())
+    { mAlgorithm.init(get<kSilenceThreshold>(), hiPassFreq); }
+    // as in AmpSliceClient, a chunk at a time so as not to allocate here
+    index size = input[0].size();
+    for (index start = 0; start < size; start += mBuffer.cols())
+    {
+      index n = std::min(size - start, mBuffer.cols());
+      auto  buffer = mBuffer(Slice(0), Slice(0, n));
+      for (index i = 0; i < channels; i++)
+        buffer.row(i) = input[asUnsigned(i)](Slice(start, n));
+      mAlgorithm.process(buffer, buffer, get<kOnThreshold>(),
+                         get<kOffThreshold>(), get<kSilenceThreshold>(),
+                         get<kFastRampUpTime>(), get<kSlowRampUpTime>(),
+                         get<kFastRampDownTime>(), get<kSlowRampDownTime>(),
+                         hiPassFreq, get<kDebounce>(),
+                         get<kApproximateLog>() == 1);
+      for (index i = 0; i < channels; i++)
+        if (output[asUnsigned(i)].data())
+          output[asUnsigned(i)](Slice(start, n)) = buffer.row(i);
+    }
+  }
+  index latency() { return 0; }
+
+  void reset()
+  {
+    double hiPassFreq = std::min(get<kHiPassFreq>() / sampleRate(), 0.5);
+    mAlgorithm.init(get<kSilenceThreshold>(), hiPassFreq);
+  }
+
+private:
+  static constexpr index kChunkSize = 512;
+
+  algorithm::MultiChannelEnvelopeSegmentation mAlgorithm{
+      get<kAmpSliceChannels>()};
+  RealMatrix mBuffer;
 };
+
 auto constexpr NRTAmpSliceParams =
     makeNRTParams<AmpSliceClient>(InputBufferParam("source", "Source Buffer"),
                                   BufferParam("indices", "Indices Buffer"));
@@ -16,6 +16,9 @@ under the European Union’s Horizon 2020 research and innovation programme
 #include "../common/ParameterTypes.hpp"
 #include "../../algorithms/public/HPSS.hpp"
 #include "../../algorithms/public/STFT.hpp"
+#include "../../algorithms/util/ParallelFor.hpp"
+#include "../../data/TensorTypes.hpp"
+#include <algorithm>
 #include <complex>
 #include <string>
 #include <tuple>
@@ -107,10 +110,112 @@ public:
         });
   }
 
+  // processOffline() holds four complex and two real spectrograms at once, so
+  // longer buffers than this budget allows are streamed through process()
+  bool useOffline(index nFrames)
+  {
+    index bytesPerBin = static_cast<index>(4 * sizeof(std::complex<double>) +
+                                           2 * sizeof(double));
+    return offlineWindows(nFrames) * get<kFFT>().frameSize() * bytesPerBin <=
+           kMaxOfflineBytes;
+  }
+
+  // Whole-buffer version of process() for BufHPSS, giving the same output
+  // without the latency: the spectrogram is analysed, separated and
+  // resynthesised in one go, with the work shared between threads
+  void processOffline(std::vector<HostVector>& input,
+                      std::vector<HostVector>& output, FluidContext& c)
+  {
+    if (!input[0].data()) return;
+
+    auto  fftParams = get<kFFT>();
+    index winSize = fftParams.winSize();
+    index hopSize = fftParams.hopSize();
+    index nBins = fftParams.frameSize();
+    index nFrames = input[0].size();
+    index nThreads = algorithm::defaultThreadCount();
+
+    index nWindows = offlineWindows(nFrames);
+    auto  padded = RealVector(nWindows * hopSize + winSize);
+    padded(Slice(winSize, nFrames)) = input[0];
+
+    auto  spectrum = ComplexMatrix(nWindows, nBins);
+    index nChunks = std::min(nWindows, 4 * nThreads);
+    algorithm::parallelFor(
+        nChunks,
+        [&](index chunk) {
+          auto stft = algorithm::STFT(winSize, fftParams.fftSize(), hopSize);
+          for (index j = chunk * nWindows / nChunks;
+               j < (chunk + 1) * nWindows / nChunks; ++j)
+            stft.processFrame(padded(Slice(j * hopSize, winSize)),
+                              spectrum.row(j));
+        },
+        nThreads);
+
+    if (c.task() && !c.task()->processUpdate(1, 3)) return;
+
+    auto separated =
+        std::vector<ComplexMatrix>(3, ComplexMatrix(nWindows, nBins));
+    algorithm::HPSS::processSpectrogram(
+        spectrum, separated[0], separated[1], separated[2], get<kPSize>(),
+        get<kHSize>(), get<kMode>(), get<kHThresh>().value[0].first,
+        get<kHThresh>().value[0].second, get<kHThresh>().value[1].first,
+        get<kHThresh>().value[1].second, get<kPThresh>().value[0].first,
+        get<kPThresh>().value[0].second, get<kPThresh>().value[1].first,
+        get<kPThresh>().value[1].second, nThreads);
+
+    if (c.task() && !c.task()->processUpdate(2, 3)) return;
+
+    // overlap-add, summing in the same order as the streaming sink does
+    auto norm = RealVector(padded.size());
+    {
+      auto stft = algorithm::STFT(winSize, fftParams.fftSize(), hopSize);
+      auto istft = algorithm::ISTFT(winSize, fftParams.fftSize(), hopSize);
+      auto window = RealVector(stft.window());
+      window.apply(istft.window(), [](double& x, double y) { x *= y; });
+      for (index j = 0; j < nWindows; ++j)
+        norm(Slice(j * hopSize, winSize))
+            .apply(window, [](double& x, double y) { x += y; });
+    }
+
+    algorithm::parallelFor(
+        3,
+        [&](index i) {
+          if (!output[asUnsigned(i)].data()) return;
+          auto istft = algorithm::ISTFT(winSize, fftParams.fftSize(), hopSize);
+          auto frame = RealVector(winSize);
+          auto result = RealVector(padded.size());
+          for (index j = 0; j < nWindows; ++j)
+          {
+            istft.processFrame(separated[asUnsigned(i)].row(j), frame);
+            result(Slice(j * hopSize, winSize))
+                .apply(frame, [](double& x, double y) { x += y; });
+          }
+          auto out = result(Slice(winSize, nFrames));
+          out.apply(norm(Slice(winSize, nFrames)), [](double& x, double g) {
+            if (x != 0) { x /= (g > 0) ? g : 1; }
+          });
+          output[asUnsigned(i)] = out;
+        },
+        nThreads);
+
+    if (c.task()) c.task()->processUpdate(3, 3);
+  }
+
 private:
+  static constexpr index kMaxOfflineBytes = index(512) << 20;
+
+  // As when streaming, window j covers the samples up to j * hopSize, and
+  // there are as many as reach back into the input
+  index offlineWindows(index nFrames)
+  {
+    index hopSize = get<kFFT>().hopSize();
+    return (nFrames + get<kFFT>().winSize() + hopSize - 1) / hopSize;
+  }
+
   STFTBufferedProcess<ParamSetViewType, T, kFFT, true> mSTFTBufferedProcess;
   ParameterTrackChanges<index, index>                  mTrackChanges;
-  algorithm::HPSS mHPSS{get<kMaxFFT>(), get<kMaxHSize>()};
+  algorithm::HPSS mHPSS{get<kMaxFFT>(), get<kMaxHSize>(), get<kMaxPSize>()};
 };
 
 auto constexpr NRTHPSSParams =
@@ -120,8 +225,8 @@ auto constexpr NRTHPSSParams =
                               BufferParam("residual", "Residual Buffer"));
 
 template <typename T>
-using NRTHPSSClient = NRTStreamAdaptor<HPSSClient<T>, decltype(NRTHPSSParams),
-                                       NRTHPSSParams, 1, 3>;
+using NRTHPSSClient = NRTOfflineAdaptor<HPSSClient<T>, decltype(NRTHPSSParams),
+                                        NRTHPSSParams, 1, 3>;
 
 template <typename T>
 using NRTThreadedHPSSClient = NRTThreadingAdaptor<NRTHPSSClient<T>>;
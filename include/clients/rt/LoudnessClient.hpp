@@ -28,7 +28,8 @@ enum LoudnessParamIndex {
   kTruePeak,
   kWindowSize,
   kHopSize,
-  kMaxWindowSize
+  kMaxWindowSize,
+  kLoudnessChannels
 };
 
 extern auto constexpr LoudnessParams = defineParameters(
@@ -70,7 +71,7 @@ public:
       mBufferedProcess.maxSize(get<kWindowSize>(), get<kWindowSize>(),
                                FluidBaseClient::audioChannelsIn(),
                                FluidBaseClient::controlChannelsOut());
-      mAlgorithm.init(get<kWindowSize>(), sampleRate());
+      mAlgorithm.init(get<kWindowSize>(), get<kHopSize>(), sampleRate());
     }
     RealMatrix in(1, hostVecSize);
     in.row(0) = input[0];
@@ -90,7 +91,7 @@ public:
   void reset()
   {
     mBufferedProcess.reset();
-    mAlgorithm.init(get<kWindowSize>(), sampleRate());
+    mAlgorithm.init(get<kWindowSize>(), get<kHopSize>(), sampleRate());
   }
 
   index controlRate() { return get<kHopSize>(); }
@@ -104,6 +105,91 @@ private:
   FluidTensor<double, 1> mDescriptors;
 };
 
+extern auto constexpr MultiChannelLoudnessParams = defineParameters(
+    EnumParam("kWeighting", "Apply K-Weighting", 1, "Off", "On"),
+    EnumParam("truePeak", "Compute True Peak", 1, "Off", "On"),
+    LongParam("windowSize", "Window Size", 1024, UpperLimit<kMaxWindowSize>()),
+    LongParam("hopSize", "Hop Size", 512, Min(1)),
+    LongParam<Fixed<true>>("maxWindowSize", "Max Window Size", 16384, Min(4),
+                           PowerOfTwo{}),
+    LongParam<Fixed<true>>("numChannels", "Number of Channels", 2, Min(1)));
+
+// Loudness of several channels in one instance, sharing the buffering and
+// K-weighting channels together; the outputs are the loudness and peak of the
+// first channel, then of the second, and so on.
+template <typename T>
+class MultiChannelLoudnessClient
+    : public FluidBaseClient<decltype(MultiChannelLoudnessParams),
+                             MultiChannelLoudnessParams>,
+      public AudioIn,
+      public ControlOut
+{
+  using HostVector = FluidTensorView<T, 1>;
+
+public:
+  MultiChannelLoudnessClient(ParamSetViewType& p) : FluidBaseClient(p)
+  {
+    FluidBaseClient::audioChannelsIn(get<kLoudnessChannels>());
+    FluidBaseClient::controlChannelsOut(2 * get<kLoudnessChannels>());
+    mDescriptors = RealMatrix(get<kLoudnessChannels>(), 2);
+  }
+
+  void process(std::vector<HostVector>& input, std::vector<HostVector>& output,
+               FluidContext& c)
+  {
+    index channels = get<kLoudnessChannels>();
+    for (index i = 0; i < channels; i++)
+      if (!input[asUnsigned(i)].data()) return;
+    assert(output.size() >= asUnsigned(FluidBaseClient::controlChannelsOut()) &&
+           "Too few output channels");
+    index hostVecSize = input[0].size();
+    if (mBufferParamsTracker.changed(hostVecSize, get<kWindowSize>(),
+                                     get<kHopSize>(), sampleRate()))
+    {
+      mBufferedProcess.hostSize(hostVecSize);
+      mBufferedProcess.maxSize(get<kWindowSize>(), get<kWindowSize>(),
+                               channels, 1);
+      mAlgorithm.init(get<kWindowSize>(), get<kHopSize>(), sampleRate());
+      mInput.resize(channels, hostVecSize);
+    }
+    for (index i = 0; i < channels; i++)
+      mInput.row(i) = input[asUnsigned(i)];
+    mBufferedProcess.push(RealMatrixView(mInput));
+    mBufferedProcess.processInput(
+        get<kWindowSize>(), get<kHopSize>(), c, [&](RealMatrixView frame) {
+          mAlgorithm.processFrame(frame, mDescriptors,
+                                  get<kKWeighting>() == 1,
+                                  get<kTruePeak>() == 1);
+        });
+    for (index i = 0; i < channels; i++)
+    {
+      if (output[asUnsigned(2 * i)].data())
+        output[asUnsigned(2 * i)](0) = static_cast<T>(mDescriptors(i, 0));
+      if (output[asUnsigned(2 * i + 1)].data())
+        output[asUnsigned(2 * i + 1)](0) = static_cast<T>(mDescriptors(i, 1));
+    }
+  }
+
+  index latency() { return get<kWindowSize>(); }
+
+  void reset()
+  {
+    mBufferedProcess.reset();
+    mAlgorithm.init(get<kWindowSize>(), get<kHopSize>(), sampleRate());
+  }
+
+  index controlRate() { return get<kHopSize>(); }
+
+private:
+  ParameterTrackChanges<index, index, index, double> mBufferParamsTracker;
+
+  algorithm::Loudness mAlgorithm{get<kMaxWindowSize>(), get<kLoudnessChannels>()};
+
+  BufferedProcess mBufferedProcess;
+  RealMatrix      mInput;
+  RealMatrix      mDescriptors;
+};
+
 auto constexpr NRTLoudnessParams =
     makeNRTParams<LoudnessClient>(InputBufferParam("source", "Source Buffer"),
                                   BufferParam("features", "Features Buffer"));
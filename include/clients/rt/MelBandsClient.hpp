@@ -30,7 +30,8 @@ enum MFCCParamIndex {
   kMaxNBands,
   kNormalize,
   kFFT,
-  kMaxFFTSize
+  kMaxFFTSize,
+  kMelBandsChannels
 };
 
 extern auto constexpr MelBandsParams = defineParameters(
@@ -112,6 +113,98 @@ private:
   FluidTensor<double, 1> mBands;
 };
 
+extern auto constexpr MultiChannelMelBandsParams = defineParameters(
+    LongParam("numBands", "Number of Bands", 40, Min(2),
+              UpperLimit<kMaxNBands>()),
+    FloatParam("minFreq", "Low Frequency Bound", 20, Min(0)),
+    FloatParam("maxFreq", "High Frequency Bound", 20000, Min(0)),
+    LongParam<Fixed<true>>("maxNumBands", "Maximum Number of Bands", 120,
+                           Min(2), MaxFrameSizeUpperLimit<kMaxFFTSize>()),
+    EnumParam("normalize", "Normalize", 1, "No", "Yes"),
+    FFTParam<kMaxFFTSize>("fftSettings", "FFT Settings", 1024, -1, -1),
+    LongParam<Fixed<true>>("maxFFTSize", "Maxiumm FFT Size", 16384),
+    LongParam<Fixed<true>>("numChannels", "Number of Channels", 2, Min(1)));
+
+// Mel bands of several channels in one instance, with the channels' frames
+// going through the filterbank together; the outputs are the bands of the
+// first channel, then of the second, and so on.
+template <typename T>
+class MultiChannelMelBandsClient
+    : public FluidBaseClient<decltype(MultiChannelMelBandsParams),
+                             MultiChannelMelBandsParams>,
+      public AudioIn,
+      public ControlOut
+
+{
+  using HostVector = FluidTensorView<T, 1>;
+
+public:
+  MultiChannelMelBandsClient(ParamSetViewType& p)
+      : FluidBaseClient{p}, mSTFTBufferedProcess(get<kMaxFFTSize>(),
+                                                 get<kMelBandsChannels>(), 0)
+  {
+    mBands = RealMatrix(get<kMelBandsChannels>(), get<kNBands>());
+    FluidBaseClient::audioChannelsIn(get<kMelBandsChannels>());
+    FluidBaseClient::controlChannelsOut(get<kMelBandsChannels>() *
+                                        get<kMaxNBands>());
+  }
+
+  void process(std::vector<HostVector>& input, std::vector<HostVector>& output,
+               FluidContext& c)
+  {
+    index channels = get<kMelBandsChannels>();
+    for (index i = 0; i < channels; i++)
+      if (!input[asUnsigned(i)].data()) return;
+    assert(output.size() >= asUnsigned(FluidBaseClient::controlChannelsOut()) &&
+           "Too few output channels");
+    if (mTracker.changed(get<kFFT>().winSize(), get<kFFT>().frameSize(),
+                         get<kNBands>(), get<kNormalize>(), get<kMinFreq>(),
+                         get<kMaxFreq>(), sampleRate()))
+    {
+      mMagnitude.resize(channels, get<kFFT>().frameSize());
+      mBands.resize(channels, get<kNBands>());
+      mMelBands.init(get<kMinFreq>(), get<kMaxFreq>(), get<kNBands>(),
+                     get<kFFT>().frameSize(), sampleRate(),
+                     get<kFFT>().winSize());
+    }
+
+    mSTFTBufferedProcess.processInput(
+        mParams, input, c, [&](ComplexMatrixView in) {
+          algorithm::STFT::magnitude(in, mMagnitude);
+          mMelBands.processFrames(mMagnitude, mBands, get<kNormalize>() == 1,
+                                  false, false);
+        });
+    index nBands = get<kNBands>();
+    for (index i = 0; i < channels; ++i)
+      for (index j = 0; j < nBands; ++j)
+        if (output[asUnsigned(i * nBands + j)].data())
+          output[asUnsigned(i * nBands + j)](0) =
+              static_cast<T>(mBands(i, j));
+  }
+
+  index latency() { return get<kFFT>().winSize(); }
+
+  void reset()
+  {
+    mSTFTBufferedProcess.reset();
+    mMelBands.init(get<kMinFreq>(), get<kMaxFreq>(), get<kNBands>(),
+                   get<kFFT>().frameSize(), sampleRate(),
+                   get<kFFT>().winSize());
+  }
+
+  index controlRate() { return get<kFFT>().hopSize(); }
+
+private:
+  ParameterTrackChanges<index, index, index, index, double, double, double>
+                                                        mTracker;
+  STFTBufferedProcess<ParamSetViewType, T, kFFT, false> mSTFTBufferedProcess;
+
+  algorithm::MelBands mMelBands{get<kMaxNBands>(), get<kMaxFFTSize>(),
+                                get<kMelBandsChannels>()};
+  RealMatrix          mMagnitude;
+  RealMatrix          mBands;
+};
+
 auto constexpr NRTMelBandsParams =
     makeNRTParams<MelBandsClient>(InputBufferParam("source", "Source Buffer"),
                                   BufferParam("features", "Output Buffer"));
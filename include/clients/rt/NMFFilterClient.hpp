@@ -9,14 +9,16 @@ under the European Union’s Horizon 2020 research and innovation programme
 */
 #pragma once
 
+#include "../common/BufferChanges.hpp"
 #include "../common/BufferedProcess.hpp"
 #include "../common/FluidBaseClient.hpp"
 #include "../common/ParameterConstraints.hpp"
 #include "../common/ParameterSet.hpp"
 #include "../common/ParameterTrackChanges.hpp"
 #include "../common/ParameterTypes.hpp"
-#include "../../algorithms/public/NMF.hpp"
+#include "../../algorithms/public/NMFFrameSolver.hpp"
 #include "../../algorithms/public/RatioMask.hpp"
+#include <algorithm>
 
 namespace fluid {
 namespace client {
@@ -44,7 +46,8 @@ class NMFFilterClient
 public:
   NMFFilterClient(ParamSetViewType& p)
       : FluidBaseClient(p),
-        mSTFTProcessor(get<kMaxFFTSize>(), 1, get<kMaxRank>())
+        mSTFTProcessor(get<kMaxFFTSize>(), 1, get<kMaxRank>()),
+        mNMF(get<kMaxRank>(), get<kMaxFFTSize>() / 2 + 1)
   {
     audioChannelsIn(1);
     audioChannelsOut(get<kMaxRank>());
@@ -52,7 +55,11 @@ public:
 
   index latency() { return get<kFFT>().winSize(); }
 
-  void reset() { mSTFTProcessor.reset(); }
+  void reset()
+  {
+    mSTFTProcessor.reset();
+    mNMF.reset();
+  }
 
   void process(std::vector<HostVector>& input, std::vector<HostVector>& output,
                FluidContext& c)
@@ -81,23 +88,25 @@ public:
         tmpOut.resize(rank);
         tmpEstimate.resize(1, fftParams.frameSize());
         tmpSource.resize(1, fftParams.frameSize());
+        tmpFilt.fill(-1); // force a reload
       }
 
-      for (index i = 0; i < tmpFilt.rows(); ++i)
-        tmpFilt.row(i) = filterBuffer.samps(i);
+      // rebuilding the dictionary also drops the warm start, so only do it
+      // when the bases are edited
+      if (impl::copyIfChanged(filterBuffer, tmpFilt))
+        mNMF.setDictionary(tmpFilt);
 
       //      controlTrigger(false);
       mSTFTProcessor.process(
           mParams, input, output, c,
           [&](ComplexMatrixView in, ComplexMatrixView out) {
             algorithm::STFT::magnitude(in, tmpMagnitude);
-            mNMF.processFrame(tmpMagnitude.row(0), tmpFilt, tmpOut,
-                              get<kIterations>(), tmpEstimate.row(0));
+            mNMF.processFrame(tmpMagnitude.row(0), tmpOut, get<kIterations>(),
+                              tmpEstimate.row(0));
             mMask.init(tmpEstimate);
             for (index i = 0; i < rank; ++i)
             {
-              algorithm::NMF::estimate(tmpFilt, RealMatrixView(tmpOut), i,
-                                       tmpSource);
+              mNMF.estimate(i, tmpSource.row(0));
               mMask.process(in, RealMatrixView{tmpSource}, 1,
                             ComplexMatrixView{out.row(i)});
             }
@@ -109,8 +118,8 @@ private:
   ParameterTrackChanges<index, index>                  mTrackValues;
   STFTBufferedProcess<ParamSetViewType, T, kFFT, true> mSTFTProcessor;
 
-  algorithm::NMF       mNMF;
-  algorithm::RatioMask mMask;
+  algorithm::NMFFrameSolver mNMF;
+  algorithm::RatioMask      mMask;
 
   RealMatrix a;
   RealMatrix tmpFilt;
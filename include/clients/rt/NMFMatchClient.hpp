@@ -9,13 +9,15 @@ under the European Union’s Horizon 2020 research and innovation programme
 */
 #pragma once
 
+#include "../common/BufferChanges.hpp"
 #include "../common/BufferedProcess.hpp"
 #include "../common/FluidBaseClient.hpp"
 #include "../common/ParameterConstraints.hpp"
 #include "../common/ParameterSet.hpp"
 #include "../common/ParameterTrackChanges.hpp"
 #include "../common/ParameterTypes.hpp"
-#include "../../algorithms/public/NMF.hpp"
+#include "../../algorithms/public/NMFFrameSolver.hpp"
+#include <algorithm>
 
 namespace fluid {
 namespace client {
@@ -48,7 +50,9 @@ class NMFMatchClient
 
 public:
   NMFMatchClient(ParamSetViewType& p)
-      : FluidBaseClient(p), mSTFTProcessor(get<kMaxFFTSize>(), 1, 0)
+      : FluidBaseClient(p),
+        mNMF(get<kMaxRank>(), get<kMaxFFTSize>() / 2 + 1),
+        mSTFTProcessor(get<kMaxFFTSize>(), 1, 0)
   {
     audioChannelsIn(1);
     controlChannelsOut(get<kMaxRank>());
@@ -56,7 +60,11 @@ public:
 
   index latency() { return get<kFFT>().winSize(); }
 
-  void reset() { mSTFTProcessor.reset(); }
+  void reset()
+  {
+    mSTFTProcessor.reset();
+    mNMF.reset();
+  }
 
   void process(std::vector<HostVector>& input, std::vector<HostVector>& output,
                FluidContext& c)
@@ -83,15 +91,18 @@ public:
         tmpFilt.resize(rank, fftParams.frameSize());
         tmpMagnitude.resize(1, fftParams.frameSize());
         tmpOut.resize(rank);
+        tmpFilt.fill(-1); // force a reload
       }
 
-      for (index i = 0; i < tmpFilt.rows(); ++i)
-        tmpFilt.row(i) = filterBuffer.samps(i);
+      // rebuilding the dictionary also drops the warm start, so only do it
+      // when the bases are edited
+      if (impl::copyIfChanged(filterBuffer, tmpFilt))
+        mNMF.setDictionary(tmpFilt);
 
       //      controlTrigger(false);
       mSTFTProcessor.processInput(mParams, input, c, [&](ComplexMatrixView in) {
         algorithm::STFT::magnitude(in, tmpMagnitude);
-        mNMF.processFrame(tmpMagnitude.row(0), tmpFilt, tmpOut);
+        mNMF.processFrame(tmpMagnitude.row(0), tmpOut, get<kIterations>());
         //          controlTrigger(true);
       });
 
@@ -102,7 +113,7 @@ public:
 
 private:
   ParameterTrackChanges<index, index> mTrackValues;
-  algorithm::NMF                      mNMF;
+  algorithm::NMFFrameSolver           mNMF;
   FluidTensor<double, 2>              tmpFilt;
   FluidTensor<double, 2>              tmpMagnitude;
   FluidTensor<double, 1>              tmpOut;
@@ -95,7 +95,7 @@ public:
     }
     else if (feature == 3)
     {
-      mLoudness.init(windowSize, sampleRate());
+      mLoudness.init(windowSize, get<kFFT>().hopSize(), sampleRate());
     }
     mFeature.resize(nDims);
     mNovelty.init(get<kKernelSize>(), get<kFilterSize>(), nDims);
@@ -112,7 +112,8 @@ public:
     index windowSize = get<kFFT>().winSize();
     index feature = get<kFeature>();
     if (mParamsTracker.changed(hostVecSize, get<kFeature>(), get<kKernelSize>(),
-                               get<kFilterSize>(), windowSize, sampleRate()))
+                               get<kFilterSize>(), windowSize,
+                               get<kFFT>().hopSize(), sampleRate()))
     {
       mBufferedProcess.hostSize(hostVecSize);
       mBufferedProcess.maxSize(windowSize, windowSize,
@@ -173,7 +174,7 @@ public:
 private:
   algorithm::NoveltySegmentation mNovelty{get<kMaxKernelSize>(),
                                           get<kMaxFilterSize>()};
-  ParameterTrackChanges<index, index, index, index, index, double>
+  ParameterTrackChanges<index, index, index, index, index, index, double>
                   mParamsTracker;
   BufferedProcess mBufferedProcess;
   algorithm::STFT mSTFT{get<kFFT>().winSize(), get<kFFT>().fftSize(),
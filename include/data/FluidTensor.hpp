@@ -255,7 +255,7 @@ public:
   operator()(Args... args) const
   {
     assert(impl::checkBounds(mDesc, args...) && "Arguments out of bounds");
-    return *(data() + mDesc(Index(args)...));
+    return *(data() + mDesc(index(args)...));
   }
 
   /// Slicing
@@ -547,7 +547,7 @@ public:
   operator()(Args... args) const
   {
     assert(impl::checkBounds(mDesc, args...) && "Arguments out of bounds");
-    return *(data() + mDesc(Index(args)...));
+    return *(data() + mDesc(index(args)...));
   }
 
   template <typename... Args>